@@ -1,7 +1,12 @@
 #include <algorithm>
+#include <array>
+#include <charconv>
 #include <pipewire/pipewire.h>
 #include <spa/param/audio/format-utils.h>
 #include <spa/param/props.h>
+// The peak picker and beat tracker are driven directly (OnsetPicker,
+// TempoTracker); aubio only declares them under its unstable API
+#define AUBIO_UNSTABLE 1
 #include <aubio/aubio.h>
 #include <memory>
 #include <iostream>
@@ -15,123 +20,3970 @@
 #include <sstream>
 #include <thread>
 #include <cmath>
+#include <cerrno>
+#include <cstdio>
+#include <ctime>
+#include <iterator>
+#include <type_traits>
+#include <string_view>
+#include <functional>
+#include <future>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <fcntl.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// Allocation tracking for verifying the RT path, built with -DBD_TRACK_ALLOCS.
+// The malloc family is interposed (operator new ends up there too) and every
+// allocation made inside an RtScope is counted and reported on stderr; with
+// BD_TRACK_ALLOCS=abort in the environment the first one aborts instead, so
+// a debugger or core dump shows the culprit. Without the flag RtScope is empty.
+#if defined(BD_TRACK_ALLOCS) && defined(__GLIBC__)
+extern "C" {
+void* __libc_malloc(size_t);
+void* __libc_calloc(size_t, size_t);
+void* __libc_realloc(void*, size_t);
+void* __libc_memalign(size_t, size_t);
+}
+
+namespace alloc_tracking {
+
+inline thread_local bool in_rt_scope = false;
+inline std::atomic<uint64_t> rt_allocations{0};
+inline std::atomic<bool> abort_on_allocation{false};
+inline std::atomic<bool> quiet{false};              // --bench counts instead of reporting each one
+
+inline void note() {
+    if (!in_rt_scope) return;
+    in_rt_scope = false;                            // nothing below may recurse into note()
+    rt_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (!quiet.load(std::memory_order_relaxed)) {
+        static const char message[] = "[BD_TRACK_ALLOCS] allocation on the RT path\n";
+        [[maybe_unused]] ssize_t r = write(STDERR_FILENO, message, sizeof(message) - 1);
+    }
+    if (abort_on_allocation.load(std::memory_order_relaxed)) std::abort();
+    in_rt_scope = true;
+}
+
+inline void init() {
+    const char* mode = std::getenv("BD_TRACK_ALLOCS");
+    abort_on_allocation = mode && std::strcmp(mode, "abort") == 0;
+}
+
+inline uint64_t count() { return rt_allocations.load(std::memory_order_relaxed); }
+
+}  // namespace alloc_tracking
+
+extern "C" {
+void* malloc(size_t n) { alloc_tracking::note(); return __libc_malloc(n); }
+void* calloc(size_t n, size_t size) { alloc_tracking::note(); return __libc_calloc(n, size); }
+void* realloc(void* p, size_t n) { alloc_tracking::note(); return __libc_realloc(p, n); }
+void* aligned_alloc(size_t align, size_t n) { alloc_tracking::note(); return __libc_memalign(align, n); }
+int posix_memalign(void** out, size_t align, size_t n) {
+    alloc_tracking::note();
+    *out = __libc_memalign(align, n);
+    return *out ? 0 : ENOMEM;
+}
+}
+
+struct RtScope {
+    RtScope() { alloc_tracking::in_rt_scope = true; }
+    ~RtScope() { alloc_tracking::in_rt_scope = false; }
+};
+#else
+struct RtScope {};
+#endif
+
+// Lock-free single-producer/single-consumer ring buffer.
+// Storage is allocated once up front (capacity rounded up to a power of two),
+// so push/pop never allocate and never block - safe to call from the RT thread.
+template <typename T>
+class SpscRing {
+public:
+    explicit SpscRing(size_t capacity)
+        : buffer_(round_up_pow2(capacity))
+        , mask_(buffer_.size() - 1)
+    {}
+    
+    SpscRing(const SpscRing&) = delete;
+    SpscRing& operator=(const SpscRing&) = delete;
+    
+    size_t capacity() const { return buffer_.size(); }
+    
+    size_t read_available() const {
+        return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_relaxed);
+    }
+    
+    // Producer side: free space, ordered after the consumer's last consume()
+    size_t write_available() const {
+        return buffer_.size() - (head_.load(std::memory_order_relaxed) - tail_.load(std::memory_order_acquire));
+    }
+    
+    // Producer side. Returns the number of elements actually written,
+    // which is less than `count` when the ring is full.
+    size_t write(const T* src, size_t count) {
+        const size_t head = head_.load(std::memory_order_relaxed);
+        const size_t tail = tail_.load(std::memory_order_acquire);
+        const size_t n = std::min(count, buffer_.size() - (head - tail));
+        
+        const size_t first = std::min(n, buffer_.size() - (head & mask_));
+        std::copy_n(src, first, buffer_.data() + (head & mask_));
+        if (n > first) std::copy_n(src + first, n - first, buffer_.data());
+        
+        head_.store(head + n, std::memory_order_release);
+        return n;
+    }
+    
+    // Consumer side. Returns the number of elements actually read.
+    size_t read(T* dst, size_t count) {
+        const size_t tail = tail_.load(std::memory_order_relaxed);
+        const size_t head = head_.load(std::memory_order_acquire);
+        const size_t n = std::min(count, head - tail);
+        
+        const size_t first = std::min(n, buffer_.size() - (tail & mask_));
+        std::copy_n(buffer_.data() + (tail & mask_), first, dst);
+        if (n > first) std::copy_n(buffer_.data(), n - first, dst + first);
+        
+        tail_.store(tail + n, std::memory_order_release);
+        return n;
+    }
+    
+    // Consumer side, zero-copy: exposes the longest contiguous readable run
+    // (up to the wrap point). Release it with consume() once processed.
+    const T* peek(size_t& count) const {
+        const size_t tail = tail_.load(std::memory_order_relaxed);
+        const size_t head = head_.load(std::memory_order_acquire);
+        count = std::min(head - tail, buffer_.size() - (tail & mask_));
+        return buffer_.data() + (tail & mask_);
+    }
+    
+    void consume(size_t count) {
+        tail_.store(tail_.load(std::memory_order_relaxed) + count, std::memory_order_release);
+    }
+
+private:
+    static size_t round_up_pow2(size_t n) {
+        size_t p = 1;
+        while (p < n) p <<= 1;
+        return p;
+    }
+    
+    std::vector<T> buffer_;
+    const size_t mask_;
+    // Producer and consumer indices live on separate cache lines
+    alignas(64) std::atomic<size_t> head_{0};
+    alignas(64) std::atomic<size_t> tail_{0};
+};
+
+// Lock-free handover of an object rebuilt on the main loop to the single
+// thread that uses it (the RT callback or the analysis worker). The consumer
+// adopts a pending object between callbacks; the one it drops is parked and
+// deleted by the main loop on its next post, so nothing is freed on the RT
+// thread. The main loop may also read the active object, since it is the
+// only thread that ever deletes one. A slot may start empty and be filled
+// by install() while the consumer already polls it.
+template<typename T>
+class SwapSlot {
+public:
+    explicit SwapSlot(std::unique_ptr<T> initial = nullptr)
+        : active_(initial.release())
+    {}
+    
+    ~SwapSlot() {
+        delete active_.load();
+        delete pending_.load();
+        delete retired_.load();
+    }
+    
+    SwapSlot(const SwapSlot&) = delete;
+    SwapSlot& operator=(const SwapSlot&) = delete;
+    
+    // Main loop: queue a replacement and free whatever was retired before it
+    void post(std::unique_ptr<T> next) {
+        delete pending_.exchange(next.release(), std::memory_order_acq_rel);
+        delete retired_.exchange(nullptr, std::memory_order_acq_rel);
+    }
+    
+    // Main loop: fill an empty slot; a slot already in use gets a post()
+    void install(std::unique_ptr<T> first) {
+        T* expected = nullptr;
+        if (active_.compare_exchange_strong(expected, first.get(), std::memory_order_acq_rel)) {
+            first.release();
+        } else {
+            post(std::move(first));
+        }
+    }
+    
+    // Consumer thread: the object to use for this callback, null while the
+    // slot is still empty. A replacement is
+    // only adopted once the previous retiree has been collected; `handover`
+    // sees the new object and the outgoing one while the latter is still
+    // safe to read, before it is retired.
+    template <typename Handover>
+    T* acquire(Handover&& handover) {
+        if (pending_.load(std::memory_order_relaxed) && !retired_.load(std::memory_order_acquire)) {
+            if (T* next = pending_.exchange(nullptr, std::memory_order_acq_rel)) {
+                T* previous = active_.load(std::memory_order_relaxed);
+                if (previous) handover(*next, *previous);
+                active_.store(next, std::memory_order_release);
+                retired_.store(previous, std::memory_order_release);
+            }
+        }
+        return active_.load(std::memory_order_acquire);
+    }
+    
+    T* acquire() { return acquire([](T&, const T&) {}); }
+    
+    // Main loop: the object currently in use, for reporting
+    T* get() const { return active_.load(std::memory_order_acquire); }
+
+private:
+    std::atomic<T*> active_;
+    std::atomic<T*> pending_{nullptr};
+    std::atomic<T*> retired_{nullptr};
+};
+
+// Fixed-capacity text for output from the analysis path: numbers are
+// formatted with std::to_chars into inline storage and the line goes out in
+// a single write(2), so printing neither allocates nor takes iostream locks.
+// Anything past CAPACITY is cut off.
+class TextLine {
+public:
+    static constexpr size_t CAPACITY = 2048;
+    
+    TextLine& operator<<(std::string_view text) {
+        size_t n = std::min(text.size(), CAPACITY - size_);
+        std::memcpy(data_ + size_, text.data(), n);
+        size_ += n;
+        return *this;
+    }
+    
+    TextLine& operator<<(char c) {
+        if (size_ < CAPACITY) data_[size_++] = c;
+        return *this;
+    }
+    
+    template <typename Int, std::enable_if_t<std::is_integral_v<Int> && !std::is_same_v<Int, char>, int> = 0>
+    TextLine& operator<<(Int value) {
+        auto result = std::to_chars(data_ + size_, data_ + CAPACITY, value);
+        if (result.ec == std::errc()) size_ = result.ptr - data_;
+        return *this;
+    }
+    
+    // Fixed-point, like std::fixed << std::setprecision(precision)
+    TextLine& fixed(double value, int precision) {
+        auto result = std::to_chars(data_ + size_, data_ + CAPACITY, value, std::chars_format::fixed, precision);
+        if (result.ec == std::errc()) size_ = result.ptr - data_;
+        return *this;
+    }
+    
+    std::string_view view() const { return std::string_view(data_, size_); }
+    size_t size() const { return size_; }
+    void clear() { size_ = 0; }
+    
+    void write_to(int fd) const {
+        for (size_t done = 0; done < size_; ) {
+            ssize_t n = write(fd, data_ + done, size_ - done);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return;
+            done += static_cast<size_t>(n);
+        }
+    }
+
+private:
+    char data_[CAPACITY];
+    size_t size_ = 0;
+};
+
+// Hop sizes with compile-time specialised kernels. make() is called with
+// std::integral_constant<size_t, HOP>, HOP = 0 standing for any other size,
+// so one switch picks the instantiation for every kernel family.
+template <typename Make>
+decltype(auto) dispatch_hop(size_t hop, Make&& make) {
+    switch (hop) {
+        case 64: return make(std::integral_constant<size_t, 64>());
+        case 128: return make(std::integral_constant<size_t, 128>());
+        case 256: return make(std::integral_constant<size_t, 256>());
+        case 512: return make(std::integral_constant<size_t, 512>());
+        case 1024: return make(std::integral_constant<size_t, 1024>());
+        default: return make(std::integral_constant<size_t, 0>());
+    }
+}
+
+// Silence-gate kernels: abs-max and sum of squares in a single pass, with a
+// fused variant that also copies the samples out of the PipeWire buffer.
+// The widest implementation the CPU supports is picked once at startup.
+// Whole hops go through measure_hop, which for the common hop sizes is an
+// instantiation with the length fixed, so the loop needs no tail or count.
+struct GateStats {
+    float peak = 0.0f;
+    float sum_sq = 0.0f;
+    
+    void merge(const GateStats& other) {
+        peak = std::max(peak, other.peak);
+        sum_sq += other.sum_sq;
+    }
+};
+
+struct GateKernels {
+    const char* name;
+    GateStats (*measure)(const float* src, size_t n);
+    GateStats (*copy_measure)(float* dst, const float* src, size_t n);
+    GateStats (*measure_hop)(const float* src, size_t n);  // n must be `hop` when that is set
+    size_t hop;                                            // 0: measure_hop takes any length
+};
+
+namespace gate_kernels {
+
+// FIXED != 0 replaces `n` with a compile-time length
+template <bool COPY, size_t FIXED = 0>
+inline GateStats scalar_impl(float* dst, const float* src, size_t n) {
+    if (FIXED) n = FIXED;
+    GateStats stats;
+    for (size_t i = 0; i < n; ++i) {
+        float s = src[i];
+        if (COPY) dst[i] = s;
+        stats.peak = std::max(stats.peak, std::abs(s));
+        stats.sum_sq += s * s;
+    }
+    return stats;
+}
+
+inline GateStats scalar_measure(const float* src, size_t n) { return scalar_impl<false>(nullptr, src, n); }
+inline GateStats scalar_copy(float* dst, const float* src, size_t n) { return scalar_impl<true>(dst, src, n); }
+template <size_t HOP>
+inline GateStats scalar_hop(const float* src, size_t n) { return scalar_impl<false, HOP>(nullptr, src, n); }
+
+#if defined(__x86_64__) || defined(__i386__)
+template <bool COPY, size_t FIXED = 0>
+inline GateStats sse2_impl(float* dst, const float* src, size_t n) {
+    if (FIXED) n = FIXED;
+    const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    __m128 peak = _mm_setzero_ps();
+    __m128 sum = _mm_setzero_ps();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 v = _mm_loadu_ps(src + i);
+        if (COPY) _mm_storeu_ps(dst + i, v);
+        peak = _mm_max_ps(peak, _mm_and_ps(v, abs_mask));
+        sum = _mm_add_ps(sum, _mm_mul_ps(v, v));
+    }
+    
+    alignas(16) float p[4], s[4];
+    _mm_store_ps(p, peak);
+    _mm_store_ps(s, sum);
+    GateStats stats = scalar_impl<COPY>(COPY ? dst + i : nullptr, src + i, n - i);
+    stats.peak = std::max({stats.peak, p[0], p[1], p[2], p[3]});
+    stats.sum_sq += (s[0] + s[1]) + (s[2] + s[3]);
+    return stats;
+}
+
+inline GateStats sse2_measure(const float* src, size_t n) { return sse2_impl<false>(nullptr, src, n); }
+inline GateStats sse2_copy(float* dst, const float* src, size_t n) { return sse2_impl<true>(dst, src, n); }
+template <size_t HOP>
+inline GateStats sse2_hop(const float* src, size_t n) { return sse2_impl<false, HOP>(nullptr, src, n); }
+
+template <bool COPY, size_t FIXED = 0>
+__attribute__((target("avx2"))) inline GateStats avx2_impl(float* dst, const float* src, size_t n) {
+    if (FIXED) n = FIXED;
+    const __m256 abs_mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+    __m256 peak = _mm256_setzero_ps();
+    __m256 sum = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 v = _mm256_loadu_ps(src + i);
+        if (COPY) _mm256_storeu_ps(dst + i, v);
+        peak = _mm256_max_ps(peak, _mm256_and_ps(v, abs_mask));
+        sum = _mm256_add_ps(sum, _mm256_mul_ps(v, v));
+    }
+    
+    alignas(32) float p[8], s[8];
+    _mm256_store_ps(p, peak);
+    _mm256_store_ps(s, sum);
+    GateStats stats = scalar_impl<COPY>(COPY ? dst + i : nullptr, src + i, n - i);
+    for (int k = 0; k < 8; ++k) {
+        stats.peak = std::max(stats.peak, p[k]);
+        stats.sum_sq += s[k];
+    }
+    return stats;
+}
+
+__attribute__((target("avx2"))) inline GateStats avx2_measure(const float* src, size_t n) { return avx2_impl<false>(nullptr, src, n); }
+__attribute__((target("avx2"))) inline GateStats avx2_copy(float* dst, const float* src, size_t n) { return avx2_impl<true>(dst, src, n); }
+template <size_t HOP>
+__attribute__((target("avx2"))) inline GateStats avx2_hop(const float* src, size_t n) { return avx2_impl<false, HOP>(nullptr, src, n); }
+#endif
+
+#if defined(__ARM_NEON)
+template <bool COPY, size_t FIXED = 0>
+inline GateStats neon_impl(float* dst, const float* src, size_t n) {
+    if (FIXED) n = FIXED;
+    float32x4_t peak = vdupq_n_f32(0.0f);
+    float32x4_t sum = vdupq_n_f32(0.0f);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        float32x4_t v = vld1q_f32(src + i);
+        if (COPY) vst1q_f32(dst + i, v);
+        peak = vmaxq_f32(peak, vabsq_f32(v));
+        sum = vmlaq_f32(sum, v, v);
+    }
+    
+    float p[4], s[4];
+    vst1q_f32(p, peak);
+    vst1q_f32(s, sum);
+    GateStats stats = scalar_impl<COPY>(COPY ? dst + i : nullptr, src + i, n - i);
+    stats.peak = std::max({stats.peak, p[0], p[1], p[2], p[3]});
+    stats.sum_sq += (s[0] + s[1]) + (s[2] + s[3]);
+    return stats;
+}
+
+inline GateStats neon_measure(const float* src, size_t n) { return neon_impl<false>(nullptr, src, n); }
+inline GateStats neon_copy(float* dst, const float* src, size_t n) { return neon_impl<true>(dst, src, n); }
+template <size_t HOP>
+inline GateStats neon_hop(const float* src, size_t n) { return neon_impl<false, HOP>(nullptr, src, n); }
+#endif
+
+template <size_t HOP>
+const GateKernels& select_for() {
+#if defined(__x86_64__) || defined(__i386__)
+    static const GateKernels avx2 = {"AVX2", avx2_measure, avx2_copy, avx2_hop<HOP>, HOP};
+    static const GateKernels sse2 = {"SSE2", sse2_measure, sse2_copy, sse2_hop<HOP>, HOP};
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return avx2;
+    if (__builtin_cpu_supports("sse2")) return sse2;
+#elif defined(__ARM_NEON)
+    // NEON is part of the baseline on AArch64 and on any build with __ARM_NEON
+    static const GateKernels neon = {"NEON", neon_measure, neon_copy, neon_hop<HOP>, HOP};
+    return neon;
+#endif
+    static const GateKernels scalar = {"scalar", scalar_measure, scalar_copy, scalar_hop<HOP>, HOP};
+    return scalar;
+}
+
+inline const GateKernels& select(size_t hop = 0) {
+    return dispatch_hop(hop, [](auto fixed) -> const GateKernels& { return select_for<decltype(fixed)::value>(); });
+}
+
+}  // namespace gate_kernels
+
+// Downmix kernels: interleaved frames to mono by averaging the channels, so
+// the graph can hand us its native layout instead of inserting a channelmix.
+// Stereo gets vector code, other layouts use the scalar loop.
+struct DownmixKernel {
+    const char* name;
+    void (*mix)(float* dst, const float* src, size_t frames, uint32_t channels);
+};
+
+namespace downmix_kernels {
+
+inline void scalar_mix(float* dst, const float* src, size_t frames, uint32_t channels) {
+    const float scale = 1.0f / channels;
+    for (size_t f = 0; f < frames; ++f, src += channels) {
+        float sum = 0.0f;
+        for (uint32_t c = 0; c < channels; ++c) sum += src[c];
+        dst[f] = sum * scale;
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+inline void sse2_mix(float* dst, const float* src, size_t frames, uint32_t channels) {
+    if (channels != 2) return scalar_mix(dst, src, frames, channels);
+    const __m128 half = _mm_set1_ps(0.5f);
+    size_t f = 0;
+    for (; f + 4 <= frames; f += 4) {
+        __m128 a = _mm_loadu_ps(src + 2 * f);          // L0 R0 L1 R1
+        __m128 b = _mm_loadu_ps(src + 2 * f + 4);      // L2 R2 L3 R3
+        __m128 left = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+        __m128 right = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+        _mm_storeu_ps(dst + f, _mm_mul_ps(_mm_add_ps(left, right), half));
+    }
+    scalar_mix(dst + f, src + 2 * f, frames - f, channels);
+}
+
+__attribute__((target("avx2"))) inline void avx2_mix(float* dst, const float* src, size_t frames, uint32_t channels) {
+    if (channels != 2) return scalar_mix(dst, src, frames, channels);
+    const __m256 half = _mm256_set1_ps(0.5f);
+    size_t f = 0;
+    for (; f + 8 <= frames; f += 8) {
+        __m256 a = _mm256_loadu_ps(src + 2 * f);
+        __m256 b = _mm256_loadu_ps(src + 2 * f + 8);
+        // hadd pairs within 128-bit lanes: a01 a23 b01 b23 | a45 a67 b45 b67
+        __m256 sums = _mm256_hadd_ps(a, b);
+        sums = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(sums), _MM_SHUFFLE(3, 1, 2, 0)));
+        _mm256_storeu_ps(dst + f, _mm256_mul_ps(sums, half));
+    }
+    sse2_mix(dst + f, src + 2 * f, frames - f, channels);
+}
+#endif
+
+#if defined(__ARM_NEON)
+inline void neon_mix(float* dst, const float* src, size_t frames, uint32_t channels) {
+    if (channels != 2) return scalar_mix(dst, src, frames, channels);
+    size_t f = 0;
+    for (; f + 4 <= frames; f += 4) {
+        float32x4x2_t lr = vld2q_f32(src + 2 * f);      // deinterleaving load
+        vst1q_f32(dst + f, vmulq_n_f32(vaddq_f32(lr.val[0], lr.val[1]), 0.5f));
+    }
+    scalar_mix(dst + f, src + 2 * f, frames - f, channels);
+}
+#endif
+
+inline const DownmixKernel& select() {
+#if defined(__x86_64__) || defined(__i386__)
+    static const DownmixKernel avx2 = {"AVX2", avx2_mix};
+    static const DownmixKernel sse2 = {"SSE2", sse2_mix};
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return avx2;
+    if (__builtin_cpu_supports("sse2")) return sse2;
+#elif defined(__ARM_NEON)
+    static const DownmixKernel neon = {"NEON", neon_mix};
+    return neon;
+#endif
+    static const DownmixKernel scalar = {"scalar", scalar_mix};
+    return scalar;
+}
+
+}  // namespace downmix_kernels
+
+// Spectral-flux kernels for the built-in onset engine: compress each bin with
+// log(1 + gamma * |X|), sum the rises against the previous frame and keep the
+// compressed frame for the next call. The log is an exponent/mantissa split
+// with a degree-5 polynomial for log2 of the mantissa (abs error < 2e-5),
+// the same in every kernel, so no libm call sits in the per-bin loop. As for
+// the gate, the common hops get instantiations with the bin count fixed.
+struct FluxKernel {
+    const char* name;
+    float (*flux)(const float* norm, float* prev, size_t n, float gamma);  // n must be `bins` when that is set
+    size_t bins;                                                           // 0: any length
+};
+
+namespace flux_kernels {
+
+constexpr float LN2 = 0.69314718f;
+constexpr float C1 = 1.4419656f;
+constexpr float C2 = -0.7096672f;
+constexpr float C3 = 0.4176218f;
+constexpr float C4 = -0.1963145f;
+constexpr float C5 = 0.0464090f;
+
+// log2(x) for normal x > 0
+inline float fast_log2(float x) {
+    uint32_t bits;
+    std::memcpy(&bits, &x, sizeof(bits));
+    float exponent = static_cast<float>(static_cast<int32_t>(bits >> 23) - 127);
+    bits = (bits & 0x007fffff) | 0x3f800000;
+    float mantissa;
+    std::memcpy(&mantissa, &bits, sizeof(mantissa));
+    float t = mantissa - 1.0f;
+    return exponent + t * (C1 + t * (C2 + t * (C3 + t * (C4 + t * C5))));
+}
+
+// Bins of the spectrum for a hop, with the FFT at 8x the hop
+constexpr size_t bins_for_hop(size_t hop) { return hop ? hop * 4 + 1 : 0; }
+
+template <size_t FIXED = 0>
+inline float scalar_flux(const float* norm, float* prev, size_t n, float gamma) {
+    if (FIXED) n = FIXED;
+    float sum = 0.0f;
+    for (size_t i = 0; i < n; ++i) {
+        float level = fast_log2(1.0f + gamma * norm[i]);
+        sum += std::max(level - prev[i], 0.0f);
+        prev[i] = level;
+    }
+    return sum * LN2;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+template <size_t FIXED = 0>
+inline float sse2_flux(const float* norm, float* prev, size_t n, float gamma) {
+    if (FIXED) n = FIXED;
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 g = _mm_set1_ps(gamma);
+    const __m128i mantissa_mask = _mm_set1_epi32(0x007fffff);
+    const __m128i one_bits = _mm_set1_epi32(0x3f800000);
+    const __m128i bias = _mm_set1_epi32(127);
+    __m128 sum = _mm_setzero_ps();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 x = _mm_add_ps(one, _mm_mul_ps(g, _mm_loadu_ps(norm + i)));
+        __m128i bits = _mm_castps_si128(x);
+        __m128 exponent = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_srli_epi32(bits, 23), bias));
+        __m128 t = _mm_sub_ps(_mm_castsi128_ps(_mm_or_si128(_mm_and_si128(bits, mantissa_mask), one_bits)), one);
+        __m128 poly = _mm_add_ps(_mm_set1_ps(C4), _mm_mul_ps(t, _mm_set1_ps(C5)));
+        poly = _mm_add_ps(_mm_set1_ps(C3), _mm_mul_ps(t, poly));
+        poly = _mm_add_ps(_mm_set1_ps(C2), _mm_mul_ps(t, poly));
+        poly = _mm_add_ps(_mm_set1_ps(C1), _mm_mul_ps(t, poly));
+        __m128 level = _mm_add_ps(exponent, _mm_mul_ps(t, poly));
+        
+        __m128 rise = _mm_max_ps(_mm_sub_ps(level, _mm_loadu_ps(prev + i)), _mm_setzero_ps());
+        sum = _mm_add_ps(sum, rise);
+        _mm_storeu_ps(prev + i, level);
+    }
+    
+    alignas(16) float s[4];
+    _mm_store_ps(s, sum);
+    return ((s[0] + s[1]) + (s[2] + s[3])) * LN2 + scalar_flux(norm + i, prev + i, n - i, gamma);
+}
+
+template <size_t FIXED = 0>
+__attribute__((target("avx2"))) inline float avx2_flux(const float* norm, float* prev, size_t n, float gamma) {
+    if (FIXED) n = FIXED;
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 g = _mm256_set1_ps(gamma);
+    const __m256i mantissa_mask = _mm256_set1_epi32(0x007fffff);
+    const __m256i one_bits = _mm256_set1_epi32(0x3f800000);
+    const __m256i bias = _mm256_set1_epi32(127);
+    __m256 sum = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 x = _mm256_add_ps(one, _mm256_mul_ps(g, _mm256_loadu_ps(norm + i)));
+        __m256i bits = _mm256_castps_si256(x);
+        __m256 exponent = _mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_srli_epi32(bits, 23), bias));
+        __m256 t = _mm256_sub_ps(_mm256_castsi256_ps(_mm256_or_si256(_mm256_and_si256(bits, mantissa_mask), one_bits)), one);
+        __m256 poly = _mm256_add_ps(_mm256_set1_ps(C4), _mm256_mul_ps(t, _mm256_set1_ps(C5)));
+        poly = _mm256_add_ps(_mm256_set1_ps(C3), _mm256_mul_ps(t, poly));
+        poly = _mm256_add_ps(_mm256_set1_ps(C2), _mm256_mul_ps(t, poly));
+        poly = _mm256_add_ps(_mm256_set1_ps(C1), _mm256_mul_ps(t, poly));
+        __m256 level = _mm256_add_ps(exponent, _mm256_mul_ps(t, poly));
+        
+        __m256 rise = _mm256_max_ps(_mm256_sub_ps(level, _mm256_loadu_ps(prev + i)), _mm256_setzero_ps());
+        sum = _mm256_add_ps(sum, rise);
+        _mm256_storeu_ps(prev + i, level);
+    }
+    
+    alignas(32) float s[8];
+    _mm256_store_ps(s, sum);
+    float total = 0.0f;
+    for (int k = 0; k < 8; ++k) total += s[k];
+    return total * LN2 + sse2_flux(norm + i, prev + i, n - i, gamma);
+}
+#endif
+
+#if defined(__ARM_NEON)
+template <size_t FIXED = 0>
+inline float neon_flux(const float* norm, float* prev, size_t n, float gamma) {
+    if (FIXED) n = FIXED;
+    const float32x4_t one = vdupq_n_f32(1.0f);
+    const uint32x4_t mantissa_mask = vdupq_n_u32(0x007fffff);
+    const uint32x4_t one_bits = vdupq_n_u32(0x3f800000);
+    const int32x4_t bias = vdupq_n_s32(127);
+    float32x4_t sum = vdupq_n_f32(0.0f);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        float32x4_t x = vaddq_f32(one, vmulq_n_f32(vld1q_f32(norm + i), gamma));
+        uint32x4_t bits = vreinterpretq_u32_f32(x);
+        float32x4_t exponent = vcvtq_f32_s32(vsubq_s32(vreinterpretq_s32_u32(vshrq_n_u32(bits, 23)), bias));
+        float32x4_t t = vsubq_f32(vreinterpretq_f32_u32(vorrq_u32(vandq_u32(bits, mantissa_mask), one_bits)), one);
+        float32x4_t poly = vaddq_f32(vdupq_n_f32(C4), vmulq_n_f32(t, C5));
+        poly = vaddq_f32(vdupq_n_f32(C3), vmulq_f32(t, poly));
+        poly = vaddq_f32(vdupq_n_f32(C2), vmulq_f32(t, poly));
+        poly = vaddq_f32(vdupq_n_f32(C1), vmulq_f32(t, poly));
+        float32x4_t level = vaddq_f32(exponent, vmulq_f32(t, poly));
+        
+        float32x4_t rise = vmaxq_f32(vsubq_f32(level, vld1q_f32(prev + i)), vdupq_n_f32(0.0f));
+        sum = vaddq_f32(sum, rise);
+        vst1q_f32(prev + i, level);
+    }
+    
+    float s[4];
+    vst1q_f32(s, sum);
+    return ((s[0] + s[1]) + (s[2] + s[3])) * LN2 + scalar_flux(norm + i, prev + i, n - i, gamma);
+}
+#endif
+
+template <size_t HOP>
+const FluxKernel& select_for() {
+    constexpr size_t BINS = bins_for_hop(HOP);
+#if defined(__x86_64__) || defined(__i386__)
+    static const FluxKernel avx2 = {"AVX2", avx2_flux<BINS>, BINS};
+    static const FluxKernel sse2 = {"SSE2", sse2_flux<BINS>, BINS};
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return avx2;
+    if (__builtin_cpu_supports("sse2")) return sse2;
+#elif defined(__ARM_NEON)
+    static const FluxKernel neon = {"NEON", neon_flux<BINS>, BINS};
+    return neon;
+#endif
+    static const FluxKernel scalar = {"scalar", scalar_flux<BINS>, BINS};
+    return scalar;
+}
+
+inline const FluxKernel& select(size_t hop = 0) {
+    return dispatch_hop(hop, [](auto fixed) -> const FluxKernel& { return select_for<decltype(fixed)::value>(); });
+}
+
+}  // namespace flux_kernels
+
+// FIR dot-product kernels for the decimator: taps against a contiguous run
+// of input history, vectorised like the other kernel families.
+struct FirKernel {
+    const char* name;
+    float (*dot)(const float* taps, const float* x, size_t n);
+};
+
+namespace fir_kernels {
+
+inline float scalar_dot(const float* taps, const float* x, size_t n) {
+    float sum = 0.0f;
+    for (size_t i = 0; i < n; ++i) sum += taps[i] * x[i];
+    return sum;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+inline float sse2_dot(const float* taps, const float* x, size_t n) {
+    __m128 a = _mm_setzero_ps();
+    __m128 b = _mm_setzero_ps();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        a = _mm_add_ps(a, _mm_mul_ps(_mm_loadu_ps(taps + i), _mm_loadu_ps(x + i)));
+        b = _mm_add_ps(b, _mm_mul_ps(_mm_loadu_ps(taps + i + 4), _mm_loadu_ps(x + i + 4)));
+    }
+    
+    alignas(16) float s[4];
+    _mm_store_ps(s, _mm_add_ps(a, b));
+    return ((s[0] + s[1]) + (s[2] + s[3])) + scalar_dot(taps + i, x + i, n - i);
+}
+
+__attribute__((target("avx2"))) inline float avx2_dot(const float* taps, const float* x, size_t n) {
+    __m256 a = _mm256_setzero_ps();
+    __m256 b = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        a = _mm256_add_ps(a, _mm256_mul_ps(_mm256_loadu_ps(taps + i), _mm256_loadu_ps(x + i)));
+        b = _mm256_add_ps(b, _mm256_mul_ps(_mm256_loadu_ps(taps + i + 8), _mm256_loadu_ps(x + i + 8)));
+    }
+    
+    alignas(32) float s[8];
+    _mm256_store_ps(s, _mm256_add_ps(a, b));
+    float total = 0.0f;
+    for (int k = 0; k < 8; ++k) total += s[k];
+    return total + sse2_dot(taps + i, x + i, n - i);
+}
+#endif
+
+#if defined(__ARM_NEON)
+inline float neon_dot(const float* taps, const float* x, size_t n) {
+    float32x4_t a = vdupq_n_f32(0.0f);
+    float32x4_t b = vdupq_n_f32(0.0f);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        a = vmlaq_f32(a, vld1q_f32(taps + i), vld1q_f32(x + i));
+        b = vmlaq_f32(b, vld1q_f32(taps + i + 4), vld1q_f32(x + i + 4));
+    }
+    
+    float s[4];
+    vst1q_f32(s, vaddq_f32(a, b));
+    return ((s[0] + s[1]) + (s[2] + s[3])) + scalar_dot(taps + i, x + i, n - i);
+}
+#endif
+
+inline const FirKernel& select() {
+#if defined(__x86_64__) || defined(__i386__)
+    static const FirKernel avx2 = {"AVX2", avx2_dot};
+    static const FirKernel sse2 = {"SSE2", sse2_dot};
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return avx2;
+    if (__builtin_cpu_supports("sse2")) return sse2;
+#elif defined(__ARM_NEON)
+    static const FirKernel neon = {"NEON", neon_dot};
+    return neon;
+#endif
+    static const FirKernel scalar = {"scalar", scalar_dot};
+    return scalar;
+}
+
+}  // namespace fir_kernels
+
+// Anti-alias low-pass and decimation by `factor` for the tempo path, in
+// polyphase form: only every factor-th output of the FIR is computed, each
+// a dot product of the (reversed) taps with a contiguous run of history.
+// Taps are a Blackman-windowed sinc cut off at 0.8x the output Nyquist, normalised
+// to unity DC gain (about -75 dB above the output Nyquist), with
+// TAPS_PER_PHASE taps per phase and a delay of 8 output samples.
+class Decimator {
+public:
+    static constexpr uint32_t TAPS_PER_PHASE = 16;
+    
+    Decimator(uint32_t factor, uint32_t max_block)
+        : factor_(factor)
+        , kernel_(fir_kernels::select())
+        , taps_(TAPS_PER_PHASE * factor)
+        , history_(taps_.size() - 1 + max_block, 0.0f)
+    {
+        const size_t n = taps_.size();
+        const double cutoff = 0.4 / factor;            // cycles per input sample
+        const double centre = (n - 1) / 2.0;
+        const double pi = 3.14159265358979323846;
+        double sum = 0.0;
+        for (size_t k = 0; k < n; ++k) {
+            double t = k - centre;
+            double sinc = t == 0.0 ? 2.0 * cutoff : std::sin(2.0 * pi * cutoff * t) / (pi * t);
+            double window = 0.42 - 0.5 * std::cos(2.0 * pi * k / (n - 1)) + 0.08 * std::cos(4.0 * pi * k / (n - 1));
+            taps_[k] = static_cast<float>(sinc * window);
+            sum += taps_[k];
+        }
+        // Symmetric, so the reversed taps the dot product wants are the same
+        for (float& tap : taps_) tap = static_cast<float>(tap / sum);
+    }
+    
+    uint32_t factor() const { return factor_; }
+    const char* kernel_name() const { return kernel_.name; }
+    
+    // n (a multiple of factor, at most max_block) samples in, n / factor out
+    void process(const float* in, uint32_t n, float* out) {
+        const size_t keep = taps_.size() - 1;
+        std::copy_n(in, n, history_.data() + keep);
+        for (uint32_t j = 0; j < n / factor_; ++j) {
+            // Output for input sample j * factor + factor - 1
+            out[j] = kernel_.dot(taps_.data(), history_.data() + j * factor_ + factor_ - 1, taps_.size());
+        }
+        std::memmove(history_.data(), history_.data() + n, keep * sizeof(float));
+    }
+
+private:
+    const uint32_t factor_;
+    const FirKernel& kernel_;
+    std::vector<float> taps_;
+    std::vector<float> history_;    // taps - 1 samples of the previous block, then the current one
+};
+
+// Which detection function drives onsets and tempo (--engine)
+enum class OnsetEngine { Aubio, Flux };
+
+inline const char* engine_name(OnsetEngine engine) {
+    return engine == OnsetEngine::Flux ? "flux" : "aubio";
+}
+
+// Spectral front-end shared by every analysis stage: the hop is windowed and
+// FFT'd once, and the detection functions are derived from that spectrum.
+// This is the same pvoc + specdesc step aubio_tempo and aubio_onset each run
+// internally, so onset, tempo and pitch no longer pay for it separately.
+// The aubio engine derives the two HFC functions; the flux engine derives a
+// single log-compressed spectral flux with the vector kernels and feeds it
+// to both tempo and onset.
+class SpectralFrontEnd {
+public:
+    static constexpr float FLUX_GAMMA = 1.0f;       // log(1 + |X|), as the log HFC
+    
+    static std::unique_ptr<SpectralFrontEnd> create(uint32_t fft_size, uint32_t hop_size, OnsetEngine engine) {
+        // Fixed-length detection loops only match the usual 8x FFT
+        uint32_t fixed_hop = fft_size == hop_size * 8 ? hop_size : 0;
+        std::unique_ptr<SpectralFrontEnd> fe(new SpectralFrontEnd(engine, fixed_hop));
+        fe->pvoc_.reset(new_aubio_pvoc(fft_size, hop_size));
+        fe->spectrum_.reset(new_cvec(fft_size));
+        fe->tempo_odf_.reset(new_fvec(1));
+        fe->onset_odf_.reset(new_fvec(1));
+        if (!fe->pvoc_ || !fe->spectrum_ || !fe->tempo_odf_ || !fe->onset_odf_) return nullptr;
+        if (engine == OnsetEngine::Flux) fe->previous_.assign(fe->spectrum_->length, 0.0f);
+        return fe;
+    }
+    
+    void process(const fvec_t* hop) {
+        transform(hop);
+        detect();
+    }
+    
+    // Spectrum only, for a front-end that feeds bars and pitch but not detection
+    void transform(const fvec_t* hop) { aubio_pvoc_do(pvoc_.get(), hop, spectrum_.get()); }
+    
+    void detect() {
+        const float* norm = spectrum_->norm;
+        
+        if (engine_ == OnsetEngine::Flux) {
+            float flux = flux_kernel_.flux(norm, previous_.data(), previous_.size(), FLUX_GAMMA);
+            tempo_odf_->data[0] = flux;
+            onset_odf_->data[0] = flux;
+            return;
+        }
+        
+        hfc_(norm, spectrum_->length, tempo_odf_->data, onset_odf_->data);
+    }
+    
+    const cvec_t* spectrum() const { return spectrum_.get(); }
+    fvec_t* tempo_odf() { return tempo_odf_.get(); }
+    fvec_t* onset_odf() { return onset_odf_.get(); }
+    OnsetEngine engine() const { return engine_; }
+    const char* flux_kernel_name() const { return flux_kernel_.name; }
+
+private:
+    SpectralFrontEnd(OnsetEngine engine, uint32_t fixed_hop)
+        : engine_(engine)
+        , flux_kernel_(flux_kernels::select(fixed_hop))
+        , hfc_(dispatch_hop(fixed_hop, [](auto fixed) { return &hfc_impl<flux_kernels::bins_for_hop(decltype(fixed)::value)>; }))
+        , pvoc_(nullptr, &del_aubio_pvoc)
+        , spectrum_(nullptr, &del_cvec)
+        , tempo_odf_(nullptr, &del_fvec)
+        , onset_odf_(nullptr, &del_fvec)
+    {}
+    
+    // HFC on the raw magnitudes (tempo) and on log(1 + |X|) (onset),
+    // matching aubio's defaults for the "hfc" method of each object
+    template <size_t FIXED>
+    static void hfc_impl(const float* norm, size_t n, float* hfc_out, float* hfc_log_out) {
+        if (FIXED) n = FIXED;
+        float hfc = 0.0f;
+        float hfc_log = 0.0f;
+        for (size_t k = 0; k < n; ++k) {
+            hfc += (k + 1) * norm[k];
+            hfc_log += (k + 1) * std::log1p(norm[k]);
+        }
+        *hfc_out = hfc;
+        *hfc_log_out = hfc_log;
+    }
+    
+    const OnsetEngine engine_;
+    const FluxKernel& flux_kernel_;
+    void (* const hfc_)(const float* norm, size_t n, float* hfc, float* hfc_log);
+    std::unique_ptr<aubio_pvoc_t, decltype(&del_aubio_pvoc)> pvoc_;
+    std::unique_ptr<cvec_t, decltype(&del_cvec)> spectrum_;
+    std::unique_ptr<fvec_t, decltype(&del_fvec)> tempo_odf_;
+    std::unique_ptr<fvec_t, decltype(&del_fvec)> onset_odf_;
+    std::vector<float> previous_;   // flux: compressed magnitudes of the previous frame
+};
+
+// Peak picking for the flux engine: a hop is an onset when it is a local
+// maximum and exceeds median + threshold * mean of the detection function
+// over the trailing window. Decisions lag by one hop (the peak test needs
+// the following value); the median is a partial sort of at most MAX_WINDOW
+// values on the stack.
+class MedianPeakPicker {
+public:
+    static constexpr uint32_t MAX_WINDOW = 64;
+    
+    explicit MedianPeakPicker(uint32_t window)
+        : window_(std::min(std::max(window, 3u), MAX_WINDOW))
+    {}
+    
+    void set_threshold(float threshold) { threshold_ = threshold; }
+    
+    // Takes this hop's value; true when the previous hop was an onset
+    bool process(float value) {
+        bool peak = previous_ > before_ && previous_ >= value && previous_ > limit_;
+        
+        history_[next_] = value;
+        next_ = (next_ + 1) % window_;
+        filled_ = std::min(filled_ + 1, window_);
+        
+        std::array<float, MAX_WINDOW> sorted;
+        float sum = 0.0f;
+        for (uint32_t i = 0; i < filled_; ++i) {
+            sorted[i] = history_[i];
+            sum += history_[i];
+        }
+        auto middle = sorted.begin() + filled_ / 2;
+        std::nth_element(sorted.begin(), middle, sorted.begin() + filled_);
+        limit_ = *middle + threshold_ * sum / filled_;
+        
+        before_ = previous_;
+        previous_ = value;
+        return peak;
+    }
+
+private:
+    const uint32_t window_;
+    float threshold_ = 0.3f;
+    std::array<float, MAX_WINDOW> history_{};
+    uint32_t next_ = 0;
+    uint32_t filled_ = 0;
+    float before_ = 0.0f;
+    float previous_ = 0.0f;
+    float limit_ = 0.0f;            // threshold for `previous_`
+};
+
+// Onset picking on a precomputed detection function: peak picking, silence
+// gate and minimum inter-onset interval, as in aubio_onset_do(). The flux
+// engine swaps aubio's peak picker for the median-threshold one.
+class OnsetPicker {
+public:
+    static constexpr float MEDIAN_WINDOW_S = 0.1f;
+    
+    static std::unique_ptr<OnsetPicker> create(uint32_t hop_size, uint32_t sample_rate, OnsetEngine engine) {
+        std::unique_ptr<OnsetPicker> op(new OnsetPicker(hop_size, sample_rate));
+        if (engine == OnsetEngine::Flux) {
+            op->median_ = std::make_unique<MedianPeakPicker>(
+                static_cast<uint32_t>(std::lround(MEDIAN_WINDOW_S * sample_rate / hop_size)));
+            return op;
+        }
+        op->peakpicker_.reset(new_aubio_peakpicker());
+        op->onset_.reset(new_fvec(1));
+        if (!op->peakpicker_ || !op->onset_) return nullptr;
+        return op;
+    }
+    
+    void set_threshold(float threshold) {
+        if (median_) {
+            median_->set_threshold(threshold);
+        } else {
+            aubio_peakpicker_set_threshold(peakpicker_.get(), threshold);
+        }
+    }
+    void set_minioi_ms(float ms) { minioi_ = static_cast<uint64_t>(ms * sample_rate_ / 1000.0f); }
+    void set_silence(float db) { silence_db_ = db; }
+    
+    bool process(fvec_t* odf, const fvec_t* hop) {
+        bool detected;
+        uint64_t onset_at;
+        if (median_) {
+            // The median picker reports the previous hop
+            detected = median_->process(odf->data[0]) && total_frames_ >= hop_size_;
+            onset_at = total_frames_ - hop_size_;
+        } else {
+            aubio_peakpicker_do(peakpicker_.get(), odf, onset_.get());
+            float position = onset_->data[0];
+            detected = position > 0.0f;
+            onset_at = total_frames_ + static_cast<uint64_t>(std::round(position * hop_size_));
+        }
+        bool is_onset = false;
+        
+        if (detected && !aubio_silence_detection(hop, silence_db_)) {
+            if (last_onset_ + minioi_ < onset_at) {
+                last_onset_ = onset_at;
+                is_onset = true;
+            }
+        }
+        
+        total_frames_ += hop_size_;
+        return is_onset;
+    }
+
+private:
+    OnsetPicker(uint32_t hop_size, uint32_t sample_rate)
+        : peakpicker_(nullptr, &del_aubio_peakpicker)
+        , onset_(nullptr, &del_fvec)
+        , hop_size_(hop_size)
+        , sample_rate_(sample_rate)
+    {}
+    
+    std::unique_ptr<aubio_peakpicker_t, decltype(&del_aubio_peakpicker)> peakpicker_;
+    std::unique_ptr<fvec_t, decltype(&del_fvec)> onset_;
+    std::unique_ptr<MedianPeakPicker> median_;
+    const uint32_t hop_size_;
+    const uint32_t sample_rate_;
+    uint64_t minioi_ = 0;
+    float silence_db_ = -70.0f;
+    uint64_t total_frames_ = 0;
+    uint64_t last_onset_ = 0;
+};
+
+// Beat tracking on a precomputed detection function. Mirrors aubio_tempo_do():
+// the thresholded ODF fills a window of ~5.8s which is handed to the beat
+// tracker every quarter window.
+class TempoTracker {
+public:
+    static std::unique_ptr<TempoTracker> create(uint32_t hop_size, uint32_t sample_rate) {
+        uint32_t winlen = 1;
+        while (winlen < 5.8f * sample_rate / hop_size) winlen <<= 1;
+        
+        std::unique_ptr<TempoTracker> tt(new TempoTracker(winlen));
+        tt->peakpicker_.reset(new_aubio_peakpicker());
+        tt->beattracking_.reset(new_aubio_beattracking(winlen, hop_size, sample_rate));
+        tt->dfframe_.reset(new_fvec(winlen));
+        tt->out_.reset(new_fvec(tt->step_));
+        tt->onset_.reset(new_fvec(1));
+        if (!tt->peakpicker_ || !tt->beattracking_ || !tt->dfframe_ || !tt->out_ || !tt->onset_) return nullptr;
+        return tt;
+    }
+    
+    void set_threshold(float threshold) { aubio_peakpicker_set_threshold(peakpicker_.get(), threshold); }
+    
+    void process(fvec_t* odf) {
+        aubio_peakpicker_do(peakpicker_.get(), odf, onset_.get());
+        dfframe_->data[winlen_ - step_ + blockpos_] = aubio_peakpicker_get_thresholded_input(peakpicker_.get())->data[0];
+        
+        // End of the window: run beat tracking and slide by one step
+        if (blockpos_ == step_ - 1) {
+            aubio_beattracking_do(beattracking_.get(), dfframe_.get(), out_.get());
+            std::memmove(dfframe_->data, dfframe_->data + step_, (winlen_ - step_) * sizeof(float));
+            std::fill(dfframe_->data + winlen_ - step_, dfframe_->data + winlen_, 0.0f);
+            blockpos_ = 0;
+        } else {
+            blockpos_++;
+        }
+    }
+    
+    float bpm() { return aubio_beattracking_get_bpm(beattracking_.get()); }
+    float confidence() { return aubio_beattracking_get_confidence(beattracking_.get()); }
+
+private:
+    explicit TempoTracker(uint32_t winlen)
+        : peakpicker_(nullptr, &del_aubio_peakpicker)
+        , beattracking_(nullptr, &del_aubio_beattracking)
+        , dfframe_(nullptr, &del_fvec)
+        , out_(nullptr, &del_fvec)
+        , onset_(nullptr, &del_fvec)
+        , winlen_(winlen)
+        , step_(winlen / 4)
+    {}
+    
+    std::unique_ptr<aubio_peakpicker_t, decltype(&del_aubio_peakpicker)> peakpicker_;
+    std::unique_ptr<aubio_beattracking_t, decltype(&del_aubio_beattracking)> beattracking_;
+    std::unique_ptr<fvec_t, decltype(&del_fvec)> dfframe_;
+    std::unique_ptr<fvec_t, decltype(&del_fvec)> out_;
+    std::unique_ptr<fvec_t, decltype(&del_fvec)> onset_;
+    const uint32_t winlen_;
+    const uint32_t step_;
+    uint32_t blockpos_ = 0;
+};
+
+// Pitch from the shared magnitude spectrum via a harmonic product spectrum,
+// refined with parabolic interpolation around the winning bin.
+class SpectralPitch {
+public:
+    static constexpr uint32_t HARMONICS = 3;
+    static constexpr float PITCH_MIN_HZ = 50.0f;
+    static constexpr float PITCH_MAX_HZ = 2000.0f;
+    
+    SpectralPitch(uint32_t fft_size, uint32_t sample_rate)
+        : bin_hz_(static_cast<float>(sample_rate) / fft_size)
+    {}
+    
+    float estimate(const cvec_t* spectrum) const {
+        const float* norm = spectrum->norm;
+        const uint32_t bins = spectrum->length;
+        const uint32_t min_bin = std::max<uint32_t>(1, static_cast<uint32_t>(PITCH_MIN_HZ / bin_hz_));
+        const uint32_t max_bin = std::min<uint32_t>(bins / HARMONICS, static_cast<uint32_t>(PITCH_MAX_HZ / bin_hz_));
+        
+        uint32_t best_bin = 0;
+        float best = 1e-9f;
+        for (uint32_t k = min_bin; k < max_bin; ++k) {
+            float product = norm[k];
+            for (uint32_t h = 2; h <= HARMONICS; ++h) product *= norm[k * h];
+            if (product > best) {
+                best = product;
+                best_bin = k;
+            }
+        }
+        if (best_bin == 0) return 0.0f;
+        
+        float a = norm[best_bin - 1], b = norm[best_bin], c = norm[best_bin + 1];
+        float denom = a - 2.0f * b + c;
+        float offset = denom != 0.0f ? 0.5f * (a - c) / denom : 0.0f;
+        return (best_bin + offset) * bin_hz_;
+    }
+
+private:
+    const float bin_hz_;
+};
+
+// --pitch off the analysis path. The analyser copies the magnitudes of the
+// hops it wants a pitch for (every beat, and otherwise at most --pitch-rate
+// per second) into one of SLOTS preallocated frames; a background thread
+// runs SpectralPitch on them and queues the estimates back, and the
+// analyser picks them up on a later hop. When every slot is still waiting
+// the request is skipped, so a slow worker never holds up analysis.
+class PitchWorker {
+public:
+    static constexpr size_t SLOTS = 8;
+    
+    struct Estimate {
+        uint64_t sample_index;      // first sample of the hop it was requested for
+        float pitch_hz;
+    };
+    
+    PitchWorker(uint32_t fft_size, uint32_t sample_rate)
+        : pitch_(fft_size, sample_rate)
+        , bins_(fft_size / 2 + 1)
+        , frames_(SLOTS * bins_)
+        , requests_(SLOTS)
+        , estimates_(SLOTS)
+    {
+        sem_init(&wake_, 0, 0);
+        thread_ = std::thread(&PitchWorker::run, this);
+        pthread_setname_np(thread_.native_handle(), "bd-pitch");
+    }
+    
+    ~PitchWorker() {
+        running_ = false;
+        sem_post(&wake_);
+        thread_.join();
+        sem_destroy(&wake_);
+    }
+    
+    PitchWorker(const PitchWorker&) = delete;
+    PitchWorker& operator=(const PitchWorker&) = delete;
+    
+    // Analysis path: a memcpy and a sem_post. False if no slot was free.
+    bool request(const cvec_t* spectrum, uint64_t sample_index) {
+        // A slot is free once the worker has consumed its request
+        if (requests_.write_available() == 0) {
+            skipped_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        Request request{sample_index, static_cast<uint32_t>(submitted_++ % SLOTS)};
+        std::copy_n(spectrum->norm, bins_, frames_.data() + request.slot * bins_);
+        requests_.write(&request, 1);
+        sem_post(&wake_);
+        return true;
+    }
+    
+    // Analysis path: the newest estimate finished since the last call
+    bool poll(Estimate& latest) {
+        Estimate estimate;
+        bool any = false;
+        while (estimates_.read(&estimate, 1) == 1) {
+            latest = estimate;
+            any = true;
+        }
+        return any;
+    }
+    
+    uint64_t completed() const { return completed_.load(std::memory_order_relaxed); }
+    uint64_t skipped() const { return skipped_.load(std::memory_order_relaxed); }
+
+private:
+    struct Request {
+        uint64_t sample_index;
+        uint32_t slot;
+    };
+    
+    void run() {
+        while (running_.load(std::memory_order_relaxed)) {
+            if (sem_wait(&wake_) != 0 && errno == EINTR) continue;
+            size_t count;
+            const Request* request;
+            while ((request = requests_.peek(count)) && count > 0) {
+                cvec_t frame{};
+                frame.length = bins_;
+                frame.norm = frames_.data() + request->slot * bins_;
+                Estimate estimate{request->sample_index, pitch_.estimate(&frame)};
+                requests_.consume(1);
+                
+                // Drained every hop, so this only fills while the analyser is not fed
+                if (estimates_.write(&estimate, 1) == 1) completed_.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+    }
+    
+    const SpectralPitch pitch_;
+    const uint32_t bins_;
+    std::vector<float> frames_;     // SLOTS magnitude frames
+    SpscRing<Request> requests_;
+    SpscRing<Estimate> estimates_;
+    uint64_t submitted_ = 0;        // analysis path only
+    sem_t wake_;
+    std::atomic<bool> running_{true};
+    std::atomic<uint64_t> completed_{0};
+    std::atomic<uint64_t> skipped_{0};
+    std::thread thread_;
+};
+
+// Visualiser bars from the shared spectrum: log-spaced bands between
+// BARS_LOW_HZ and BARS_HIGH_HZ, auto-gained and with a cava-like falloff.
+class SpectrumBars {
+public:
+    static constexpr uint32_t MAX_BARS = 256;
+    static constexpr float BARS_LOW_HZ = 50.0f;
+    static constexpr float BARS_HIGH_HZ = 10000.0f;
+    static constexpr float FALL_TIME_S = 0.25f;     // time for a bar to fall to ~37%
+    static constexpr float GAIN_RELEASE_S = 2.0f;   // auto-gain peak release
+    
+    SpectrumBars(uint32_t bar_count, uint32_t fft_size, uint32_t hop_size, uint32_t sample_rate)
+        : count_(std::min(bar_count, MAX_BARS))
+        , edges_(count_ + 1)
+        , values_(count_, 0.0f)
+        , fall_(std::exp(-static_cast<float>(hop_size) / (sample_rate * FALL_TIME_S)))
+        , release_(std::exp(-static_cast<float>(hop_size) / (sample_rate * GAIN_RELEASE_S)))
+    {
+        // Band edges in bins, each band at least one bin wide
+        const float bin_hz = static_cast<float>(sample_rate) / fft_size;
+        const uint32_t last_bin = fft_size / 2;
+        const float high = std::min(BARS_HIGH_HZ, sample_rate / 2.0f);
+        uint32_t prev = 0;
+        for (uint32_t i = 0; i <= count_; ++i) {
+            float hz = BARS_LOW_HZ * std::pow(high / BARS_LOW_HZ, static_cast<float>(i) / count_);
+            uint32_t bin = static_cast<uint32_t>(std::lround(hz / bin_hz));
+            bin = std::min(std::max(bin, i == 0 ? 1u : prev + 1), last_bin);
+            edges_[i] = prev = bin;
+        }
+    }
+    
+    void process(const cvec_t* spectrum) {
+        const float* norm = spectrum->norm;
+        float frame_peak = 0.0f;
+        for (uint32_t i = 0; i < count_; ++i) {
+            float sum = 0.0f;
+            for (uint32_t k = edges_[i]; k < edges_[i + 1]; ++k) sum += norm[k];
+            float magnitude = edges_[i + 1] > edges_[i] ? sum / (edges_[i + 1] - edges_[i]) : 0.0f;
+            frame_peak = std::max(frame_peak, magnitude);
+            magnitudes_[i] = magnitude;
+        }
+        
+        gain_peak_ = std::max({frame_peak, gain_peak_ * release_, MIN_GAIN_PEAK});
+        for (uint32_t i = 0; i < count_; ++i) {
+            values_[i] = std::max(magnitudes_[i] / gain_peak_, values_[i] * fall_);
+        }
+    }
+    
+    // Silent hops skip the FFT; bars just fall
+    void decay() {
+        for (float& v : values_) v *= fall_;
+    }
+    
+    uint32_t count() const { return count_; }
+    const float* values() const { return values_.data(); }
+
+private:
+    static constexpr float MIN_GAIN_PEAK = 1e-3f;
+    
+    const uint32_t count_;
+    std::vector<uint32_t> edges_;
+    std::vector<float> values_;
+    float magnitudes_[MAX_BARS] = {};
+    const float fall_;
+    const float release_;
+    float gain_peak_ = MIN_GAIN_PEAK;
+};
+
+// Kick, snare and hi-hat events from the shared spectrum. Each band sums the
+// log-compressed spectral flux of its bins with the flux kernels (the loop
+// the flux engine runs over the whole spectrum), so three bands cost about
+// one pass over the bins they cover and no extra FFT. Every band keeps its
+// own median threshold, floor and minimum inter-onset interval, so a busy
+// hat line cannot hide the kick. An onset must also reach a fraction of the
+// band's recent peak, which keeps leakage from a neighbouring band's hits
+// (and the fluctuations of a few-bin band on noise) below the line. Like the
+// flux engine, an event is reported one hop late, when the peak test has
+// seen the following value.
+class BandOnsets {
+public:
+    static constexpr uint32_t COUNT = 3;
+    static constexpr uint32_t BAND_LOW = 1u << 0;   // kick
+    static constexpr uint32_t BAND_MID = 1u << 1;   // snare
+    static constexpr uint32_t BAND_HIGH = 1u << 2;  // hi-hat
+    
+    struct Band {
+        const char* name;
+        float low_hz;
+        float high_hz;
+        float min_ioi_ms;
+    };
+    static constexpr Band BANDS[COUNT] = {
+        {"kick", 30.0f, 150.0f, 120.0f},
+        {"snare", 200.0f, 2500.0f, 100.0f},
+        {"hat", 6000.0f, 16000.0f, 60.0f},
+    };
+    
+    static constexpr float GAMMA = 0.1f;            // log(1 + 0.1|X|): less compressed than the full-band flux
+    static constexpr float THRESHOLD = 1.0f;        // median + THRESHOLD * mean
+    static constexpr float WINDOW_S = 0.25f;        // median history
+    static constexpr float PEAK_FRACTION = 0.5f;    // of the band's auto-gain peak
+    static constexpr float FLOOR_PER_BIN = 0.001f;  // flux a hop needs per bin to count at all
+    static constexpr float FALL_TIME_S = 0.1f;      // level envelope falloff, as for the bars
+    static constexpr float GAIN_RELEASE_S = 2.0f;
+    
+    BandOnsets(uint32_t fft_size, uint32_t hop_size, uint32_t sample_rate)
+        : kernel_(flux_kernels::select())
+        , previous_(fft_size / 2 + 1, 0.0f)
+        , fall_(std::exp(-static_cast<float>(hop_size) / (sample_rate * FALL_TIME_S)))
+        , release_(std::exp(-static_cast<float>(hop_size) / (sample_rate * GAIN_RELEASE_S)))
+    {
+        // Bands above Nyquist are left empty and never fire
+        const float bin_hz = static_cast<float>(sample_rate) / fft_size;
+        const uint32_t last_bin = fft_size / 2;
+        const uint32_t window = static_cast<uint32_t>(std::lround(WINDOW_S * sample_rate / hop_size));
+        pickers_.reserve(COUNT);
+        for (uint32_t b = 0; b < COUNT; ++b) {
+            begin_[b] = std::min(std::max(1u, static_cast<uint32_t>(std::lround(BANDS[b].low_hz / bin_hz))), last_bin);
+            end_[b] = std::min(static_cast<uint32_t>(std::lround(BANDS[b].high_hz / bin_hz)), last_bin + 1);
+            end_[b] = std::max(end_[b], begin_[b]);
+            floor_[b] = FLOOR_PER_BIN * (end_[b] - begin_[b]);
+            min_ioi_hops_[b] = static_cast<uint32_t>(BANDS[b].min_ioi_ms * sample_rate / (1000.0f * hop_size));
+            pickers_.emplace_back(window);
+            pickers_.back().set_threshold(THRESHOLD);
+        }
+    }
+    
+    // Returns the BAND_ bits of the bands with an onset on the previous hop
+    uint32_t process(const cvec_t* spectrum) {
+        const float* norm = spectrum->norm;
+        uint32_t events = 0;
+        for (uint32_t b = 0; b < COUNT; ++b) {
+            const uint32_t bins = end_[b] - begin_[b];
+            float flux = bins ? kernel_.flux(norm + begin_[b], previous_.data() + begin_[b], bins, GAMMA) : 0.0f;
+            
+            bool peak = pickers_[b].process(flux) && last_flux_[b] > std::max(floor_[b], PEAK_FRACTION * gain_peak_[b]);
+            if (peak && hops_since_[b] >= min_ioi_hops_[b]) {
+                events |= 1u << b;
+                hops_since_[b] = 0;
+                totals_[b]++;
+            }
+            hops_since_[b]++;
+            last_flux_[b] = flux;
+            
+            gain_peak_[b] = std::max({flux, gain_peak_[b] * release_, floor_[b], MIN_GAIN_PEAK});
+            levels_[b] = std::max(flux / gain_peak_[b], levels_[b] * fall_);
+        }
+        return events;
+    }
+    
+    // Silent hops skip the FFT; levels just fall
+    void decay() {
+        for (uint32_t b = 0; b < COUNT; ++b) {
+            levels_[b] *= fall_;
+            hops_since_[b]++;
+        }
+    }
+    
+    const float* levels() const { return levels_.data(); }
+    uint64_t total(uint32_t band) const { return totals_[band]; }
+    bool covered(uint32_t band) const { return end_[band] > begin_[band]; }
+
+private:
+    static constexpr float MIN_GAIN_PEAK = 1e-3f;
+    
+    const FluxKernel& kernel_;
+    std::vector<float> previous_;   // compressed magnitudes of the previous frame, band bins only
+    std::vector<MedianPeakPicker> pickers_;
+    std::array<uint32_t, COUNT> begin_{};
+    std::array<uint32_t, COUNT> end_{};
+    std::array<float, COUNT> floor_{};
+    std::array<uint32_t, COUNT> min_ioi_hops_{};
+    std::array<uint32_t, COUNT> hops_since_{};
+    std::array<float, COUNT> last_flux_{};
+    std::array<float, COUNT> gain_peak_{};
+    std::array<float, COUNT> levels_{};
+    std::array<uint64_t, COUNT> totals_{};
+    const float fall_;
+    const float release_;
+};
+
+inline uint64_t clock_ns(clockid_t clock) {
+    timespec ts;
+    clock_gettime(clock, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+}
+
+// Latest detector values, produced once per analysed hop
+struct BeatSnapshot {
+    float bpm = 0.0f;
+    float confidence = 0.0f;
+    float amplitude = 0.0f;
+    float pitch_hz = 0.0f;
+    bool is_beat = false;
+    bool is_stable = false;
+    float average_bpm = 0.0f;
+    float median_bpm = 0.0f;
+    float octave_bpm = 0.0f;
+    float bpm_deviation = 0.0f;
+    uint32_t source_id = 0;         // PipeWire node id of the analysed stream
+    uint64_t time_ns = 0;           // CLOCK_MONOTONIC time of this hop
+    float beat_phase = 0.0f;        // 0..1 since the last predicted beat
+    float beat_period_ms = 0.0f;
+    uint64_t next_beat_ns = 0;      // CLOCK_MONOTONIC time of the predicted next beat, 0 while unlocked
+    const float* bars = nullptr;    // SpectrumBars values (0..1), bar_count entries
+    uint32_t bar_count = 0;
+    bool has_bands = false;         // --bands
+    uint32_t band_events = 0;       // BandOnsets::BAND_ bits
+    std::array<float, BandOnsets::COUNT> band_levels{};
+};
+
+// Fixed-layout block published in shared memory (/dev/shm/<name>, and
+// /dev/shm/<name>-<n> for every further --target).
+// Readers follow the seqlock protocol:
+//   do { s1 = sequence (acquire); if (s1 & 1) retry; copy fields; fence; } while (sequence != s1);
+// `beat_count` only ever grows, so a reader polling at a lower rate than
+// the beat rate can still tell how many beats it missed.
+struct BeatShmState {
+    static constexpr uint32_t MAGIC = 0x31534442;  // "BDS1"
+    static constexpr uint32_t VERSION = 6;
+    static constexpr uint32_t FLAG_BEAT = 1u << 0; // a beat happened since the previous update
+    static constexpr uint32_t FLAG_STABLE = 1u << 1; // BPM deviation is below the stability limit
+    static constexpr uint32_t FLAG_LOCKED = 1u << 2; // the beat phase is locked and next_beat_ns is valid
+    
+    uint32_t magic;
+    uint32_t version;
+    std::atomic<uint32_t> sequence;
+    uint32_t flags;
+    int32_t writer_pid;
+    int32_t eventfd;                // fd number in the writer for pidfd_getfd(), or EVENTFD on --daemon; -1 if unused
+    uint64_t update_time_ns;
+    uint64_t beat_count;
+    uint64_t last_beat_ns;
+    float bpm;
+    float confidence;
+    float amplitude;
+    float pitch_hz;
+    // v2: visualiser bars, 0..1
+    uint32_t bar_count;
+    uint32_t source_id;             // v4: PipeWire node id of the stream (reserved before)
+    float bars[SpectrumBars::MAX_BARS];
+    // v3: beat history statistics
+    float average_bpm;
+    float median_bpm;
+    float octave_bpm;
+    float bpm_deviation;
+    // v5: beat phase prediction
+    uint64_t next_beat_ns;
+    float beat_phase;
+    float beat_period_ms;
+    // v6: kick/snare/hat events (--bands), counted like beat_count
+    uint64_t band_counts[BandOnsets::COUNT];
+    float band_levels[BandOnsets::COUNT];   // 0..1 onset envelopes
+    uint32_t band_flags;                    // BandOnsets::BAND_ bits with an event since the previous update
+};
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "seqlock needs a lock-free counter");
+static_assert(sizeof(BeatShmState) == 72 + 4 * SpectrumBars::MAX_BARS + 32 + 40, "BeatShmState layout is part of the output ABI");
+
+// Binary output channel: publishes BeatSnapshot values into a BeatShmState
+// segment, coalesced to at most `max_rate_hz` and only when something changed.
+class ShmPublisher {
+public:
+    static std::unique_ptr<ShmPublisher> create(const std::string& name, float max_rate_hz, bool use_eventfd) {
+        std::string path = name[0] == '/' ? name : "/" + name;
+        int fd = shm_open(path.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+        // A segment whose writer is gone is left over from a crash
+        if (fd < 0 && errno == EEXIST) {
+            if (writer_alive(path)) {
+                errno = EEXIST;
+                return nullptr;
+            }
+            shm_unlink(path.c_str());
+            fd = shm_open(path.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+        }
+        if (fd < 0) return nullptr;
+        if (ftruncate(fd, sizeof(BeatShmState)) != 0) {
+            close(fd);
+            shm_unlink(path.c_str());
+            return nullptr;
+        }
+        void* map = mmap(nullptr, sizeof(BeatShmState), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (map == MAP_FAILED) {
+            shm_unlink(path.c_str());
+            return nullptr;
+        }
+        
+        std::unique_ptr<ShmPublisher> pub(new ShmPublisher(path, static_cast<BeatShmState*>(map), max_rate_hz));
+        if (use_eventfd) {
+            pub->eventfd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        }
+        
+        BeatShmState* st = pub->state_;
+        std::memset(static_cast<void*>(st), 0, sizeof(BeatShmState));
+        st->magic = BeatShmState::MAGIC;
+        st->version = BeatShmState::VERSION;
+        st->writer_pid = getpid();
+        st->eventfd = pub->eventfd_;
+        return pub;
+    }
+    
+    ~ShmPublisher() {
+        munmap(state_, sizeof(BeatShmState));
+        shm_unlink(path_.c_str());
+        if (eventfd_ >= 0) close(eventfd_);
+    }
+    
+    ShmPublisher(const ShmPublisher&) = delete;
+    ShmPublisher& operator=(const ShmPublisher&) = delete;
+    
+    const std::string& path() const { return path_; }
+    int eventfd_fd() const { return eventfd_; }
+    
+    void publish(const BeatSnapshot& snap) {
+        if (snap.is_beat) {
+            pending_beats_++;
+            last_beat_ns_ = snap.time_ns;
+        }
+        for (uint32_t b = 0; b < BandOnsets::COUNT; ++b) {
+            if (snap.band_events & (1u << b)) pending_bands_[b]++;
+        }
+        pending_band_flags_ |= snap.band_events;
+        
+        if (snap.time_ns - last_publish_ns_ < min_interval_ns_) return;
+        if (pending_beats_ == 0 && pending_band_flags_ == 0 && !changed(snap)) return;
+        
+        BeatShmState* st = state_;
+        uint32_t seq = st->sequence.load(std::memory_order_relaxed);
+        st->sequence.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        
+        st->flags = (pending_beats_ > 0 ? BeatShmState::FLAG_BEAT : 0)
+                  | (snap.is_stable ? BeatShmState::FLAG_STABLE : 0)
+                  | (snap.next_beat_ns ? BeatShmState::FLAG_LOCKED : 0);
+        st->update_time_ns = snap.time_ns;
+        st->beat_count += pending_beats_;
+        st->last_beat_ns = last_beat_ns_;
+        st->bpm = snap.bpm;
+        st->confidence = snap.confidence;
+        st->amplitude = snap.amplitude;
+        st->pitch_hz = snap.pitch_hz;
+        st->bar_count = snap.bar_count;
+        st->source_id = snap.source_id;
+        std::copy_n(snap.bars, snap.bar_count, st->bars);
+        st->average_bpm = snap.average_bpm;
+        st->median_bpm = snap.median_bpm;
+        st->octave_bpm = snap.octave_bpm;
+        st->bpm_deviation = snap.bpm_deviation;
+        st->next_beat_ns = snap.next_beat_ns;
+        st->beat_phase = snap.beat_phase;
+        st->beat_period_ms = snap.beat_period_ms;
+        for (uint32_t b = 0; b < BandOnsets::COUNT; ++b) {
+            st->band_counts[b] += pending_bands_[b];
+            st->band_levels[b] = snap.band_levels[b];
+        }
+        st->band_flags = pending_band_flags_;
+        
+        st->sequence.store(seq + 2, std::memory_order_release);
+        
+        if (eventfd_ >= 0) {
+            uint64_t one = 1;
+            [[maybe_unused]] ssize_t r = write(eventfd_, &one, sizeof(one));
+        }
+        
+        last_published_ = snap;
+        last_publish_ns_ = snap.time_ns;
+        pending_beats_ = 0;
+        pending_bands_ = {};
+        pending_band_flags_ = 0;
+    }
+
+private:
+    ShmPublisher(std::string path, BeatShmState* state, float max_rate_hz)
+        : path_(std::move(path))
+        , state_(state)
+        , min_interval_ns_(max_rate_hz > 0.0f ? static_cast<uint64_t>(1e9f / max_rate_hz) : 0)
+    {}
+    
+    // Whether the segment at `path` belongs to a running process; anything
+    // that is not a BeatShmState counts as alive, so it is never removed
+    static bool writer_alive(const std::string& path) {
+        int fd = shm_open(path.c_str(), O_RDONLY, 0);
+        if (fd < 0) return errno != ENOENT;
+        struct stat info;
+        if (fstat(fd, &info) != 0 || info.st_size < static_cast<off_t>(sizeof(BeatShmState))) {
+            close(fd);
+            return true;
+        }
+        void* map = mmap(nullptr, sizeof(BeatShmState), PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (map == MAP_FAILED) return true;
+        const auto* st = static_cast<const BeatShmState*>(map);
+        bool alive = st->magic != BeatShmState::MAGIC || st->writer_pid <= 0
+                     || kill(st->writer_pid, 0) == 0 || errno == EPERM;
+        munmap(map, sizeof(BeatShmState));
+        return alive;
+    }
+    
+    bool changed(const BeatSnapshot& snap) const {
+        return std::abs(snap.bpm - last_published_.bpm) >= 0.05f
+            || std::abs(snap.confidence - last_published_.confidence) >= 0.005f
+            || std::abs(snap.amplitude - last_published_.amplitude) >= 0.001f
+            || std::abs(snap.pitch_hz - last_published_.pitch_hz) >= 0.5f
+            || std::abs(snap.octave_bpm - last_published_.octave_bpm) >= 0.05f
+            || snap.is_stable != last_published_.is_stable
+            || (snap.next_beat_ns != 0) != (last_published_.next_beat_ns != 0)
+            || std::llabs(static_cast<long long>(snap.next_beat_ns - last_published_.next_beat_ns)) >= 2000000
+            || bars_changed(snap)
+            || bands_changed(snap);
+    }
+    
+    bool bands_changed(const BeatSnapshot& snap) const {
+        for (uint32_t b = 0; b < BandOnsets::COUNT; ++b) {
+            if (std::abs(snap.band_levels[b] - last_published_.band_levels[b]) >= 0.01f) return true;
+        }
+        return false;
+    }
+    
+    bool bars_changed(const BeatSnapshot& snap) const {
+        if (snap.bar_count != state_->bar_count) return true;
+        for (uint32_t i = 0; i < snap.bar_count; ++i) {
+            if (std::abs(snap.bars[i] - state_->bars[i]) >= 0.01f) return true;
+        }
+        return false;
+    }
+    
+    const std::string path_;
+    BeatShmState* state_;
+    const uint64_t min_interval_ns_;
+    int eventfd_ = -1;
+    BeatSnapshot last_published_;
+    uint64_t last_publish_ns_ = 0;
+    uint64_t last_beat_ns_ = 0;
+    uint64_t pending_beats_ = 0;
+    std::array<uint64_t, BandOnsets::COUNT> pending_bands_{};
+    uint32_t pending_band_flags_ = 0;
+};
+
+// --daemon: one capture and one analysis shared by any number of clients
+// over a Unix stream socket, driven from the PipeWire main loop. Text
+// protocol, one line per message:
+//   client: SUBSCRIBE <field>[,<field>...]   replaces the field set
+//           SOURCE <node id>|primary|all     which source(s) to follow, primary by default
+//           UNSUBSCRIBE | PING
+//           SET <key>=<value>[,...] | CONFIG   change or show the analysis settings
+//           EVENTFD [<node id>|primary]      the --shm-eventfd of a source, the followed one by default
+//   server: HELLO beat_detector 4            on connect
+//           U source=<id> <field>=<value> ...  on every beat and at most --daemon-rate per second
+//           OK <fields> | CONFIG <key>=<value> ... | PONG | ERR <reason>
+// Fields: bpm confidence amplitude pitch beat stable average median octave
+// deviation phase next, `all` for every one of those, and bars or bars=<n>
+// (resampled to n), and bands. `beat` counts the beats since the previous
+// update; bars are 0..100 integers separated by ';', like cava's raw output.
+// `bands` (with --bands) sends kick=, snare= and hat= counts since the
+// previous update the same way, and bands=<kick>;<snare>;<hat>; levels
+// 0..100. `next` sends the predicted next beat as next=<CLOCK_MONOTONIC ns>
+// and next_in=<ms from when the line was sent>, both -1 while the phase is
+// not locked. The primary source is the first --target; `source` is always
+// the PipeWire node id. SET keys: hop, engine (aubio|flux), decimate,
+// pitch (on|off), pitch-rate, bars, bands (on|off), and the thresholds gate
+// (dB), onset, tempo, confidence and ioi (ms); settings apply to every
+// source and every client. EVENTFD answers `OK eventfd` with the descriptor
+// attached as SCM_RIGHTS; an eventfd cannot be reopened through /proc, so
+// without --daemon a reader has to take it with pidfd_open(writer_pid) and
+// pidfd_getfd(), which needs ptrace access to the detector. Every holder
+// shares one counter: whoever reads it resets it for the others.
+class SubscriberServer {
+public:
+    static constexpr uint32_t PROTOCOL = 4;
+    
+    using ControlHandler = std::function<std::string(const std::string&)>;
+    using EventfdLookup = std::function<int(uint32_t node_id, bool primary)>;
+    
+    // `on_demand` is called on the main loop whenever the number of
+    // subscribed clients changes; `on_control` answers SET and CONFIG;
+    // `eventfd_of` finds a source's shared-memory eventfd, -1 if it has none
+    static std::unique_ptr<SubscriberServer> create(const std::string& path, pw_loop* loop,
+                                                    std::function<void(size_t)> on_demand, ControlHandler on_control,
+                                                    EventfdLookup eventfd_of) {
+        sockaddr_un addr = {};
+        addr.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(addr.sun_path)) {
+            errno = ENAMETOOLONG;
+            return nullptr;
+        }
+        std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+        
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0) return nullptr;
+        
+        // A socket file nobody answers on is left over from a crash
+        if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0) {
+            close(fd);
+            errno = EADDRINUSE;
+            return nullptr;
+        }
+        unlink(path.c_str());
+        
+        if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || listen(fd, 16) != 0) {
+            int err = errno;
+            close(fd);
+            errno = err;
+            return nullptr;
+        }
+        
+        std::unique_ptr<SubscriberServer> server(new SubscriberServer(path, loop, fd, std::move(on_demand), std::move(on_control),
+                                                                      std::move(eventfd_of)));
+        server->listen_source_ = pw_loop_add_io(loop, fd, SPA_IO_IN, false, on_accept, server.get());
+        return server;
+    }
+    
+    ~SubscriberServer() {
+        for (auto& client : clients_) {
+            pw_loop_destroy_source(loop_, client->source);
+            close(client->fd);
+        }
+        if (listen_source_) pw_loop_destroy_source(loop_, listen_source_);
+        close(listen_fd_);
+        unlink(path_.c_str());
+    }
+    
+    SubscriberServer(const SubscriberServer&) = delete;
+    SubscriberServer& operator=(const SubscriberServer&) = delete;
+    
+    const std::string& path() const { return path_; }
+    size_t subscribers() const { return subscribers_; }
+    
+    // Main loop: format `snap` for every client following its source and send it.
+    // Clients asking for the same fields share one formatted line.
+    void broadcast(const BeatSnapshot& snap, uint32_t beats, const std::array<uint32_t, BandOnsets::COUNT>& band_beats,
+                   bool primary) {
+        const uint64_t now_ns = clock_ns(CLOCK_MONOTONIC);
+        uint32_t line_fields = 0;
+        uint32_t line_bars = 0;
+        for (auto& client : clients_) {
+            if (client->fields == 0) continue;
+            if (client->follow == SOURCE_PRIMARY ? !primary
+                : client->follow != SOURCE_ALL && client->follow != snap.source_id) continue;
+            
+            uint32_t bar_count = client->bar_count ? client->bar_count : snap.bar_count;
+            if (client->fields != line_fields || bar_count != line_bars) {
+                format_update(snap, beats, band_beats, client->fields, bar_count, now_ns);
+                line_fields = client->fields;
+                line_bars = bar_count;
+            }
+            send_to(*client, line_.view());
+        }
+        sweep();
+    }
+
+private:
+    static constexpr uint32_t FIELD_BPM = 1u << 0;
+    static constexpr uint32_t FIELD_CONFIDENCE = 1u << 1;
+    static constexpr uint32_t FIELD_AMPLITUDE = 1u << 2;
+    static constexpr uint32_t FIELD_PITCH = 1u << 3;
+    static constexpr uint32_t FIELD_BEAT = 1u << 4;
+    static constexpr uint32_t FIELD_STABLE = 1u << 5;
+    static constexpr uint32_t FIELD_AVERAGE = 1u << 6;
+    static constexpr uint32_t FIELD_MEDIAN = 1u << 7;
+    static constexpr uint32_t FIELD_OCTAVE = 1u << 8;
+    static constexpr uint32_t FIELD_DEVIATION = 1u << 9;
+    static constexpr uint32_t FIELD_BARS = 1u << 10;
+    static constexpr uint32_t FIELD_PHASE = 1u << 11;
+    static constexpr uint32_t FIELD_NEXT = 1u << 12;
+    static constexpr uint32_t FIELD_BANDS = 1u << 13;
+    static constexpr uint32_t FIELD_ALL = (FIELD_BARS - 1) | FIELD_PHASE | FIELD_NEXT;
+    static constexpr size_t MAX_LINE = 4096;
+    static constexpr size_t MAX_BACKLOG = 256 * 1024;    // a client this far behind is dropped
+    static constexpr uint32_t SOURCE_PRIMARY = 0xfffffffe;
+    static constexpr uint32_t SOURCE_ALL = 0xffffffff;
+    
+    struct Client {
+        SubscriberServer* server;
+        int fd;
+        spa_source* source = nullptr;
+        uint32_t fields = 0;
+        uint32_t bar_count = 0;         // 0: the detector's own bar count
+        uint32_t follow = SOURCE_PRIMARY; // node id, or one of the SOURCE_ values
+        bool dead = false;
+        std::string in;
+        std::string out;
+    };
+    
+    SubscriberServer(std::string path, pw_loop* loop, int fd, std::function<void(size_t)> on_demand,
+                     ControlHandler on_control, EventfdLookup eventfd_of)
+        : path_(std::move(path))
+        , loop_(loop)
+        , listen_fd_(fd)
+        , on_demand_(std::move(on_demand))
+        , on_control_(std::move(on_control))
+        , eventfd_of_(std::move(eventfd_of))
+    {}
+    
+    static void on_accept(void* userdata, int fd, uint32_t) {
+        auto* server = static_cast<SubscriberServer*>(userdata);
+        int client_fd;
+        while ((client_fd = accept4(fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+            auto client = std::make_unique<Client>();
+            client->server = server;
+            client->fd = client_fd;
+            client->source = pw_loop_add_io(server->loop_, client_fd, SPA_IO_IN | SPA_IO_ERR | SPA_IO_HUP,
+                                            false, on_client, client.get());
+            server->send_to(*client, "HELLO beat_detector " + std::to_string(PROTOCOL) + "\n");
+            server->clients_.push_back(std::move(client));
+        }
+    }
+    
+    static void on_client(void* userdata, int fd, uint32_t mask) {
+        auto* client = static_cast<Client*>(userdata);
+        SubscriberServer* server = client->server;
+        
+        char buffer[1024];
+        ssize_t n;
+        while ((n = recv(fd, buffer, sizeof(buffer), 0)) > 0) {
+            client->in.append(buffer, static_cast<size_t>(n));
+        }
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) || (mask & (SPA_IO_ERR | SPA_IO_HUP))) {
+            client->dead = true;
+        }
+        
+        size_t eol;
+        while (!client->dead && (eol = client->in.find('\n')) != std::string::npos) {
+            std::string line = client->in.substr(0, eol);
+            client->in.erase(0, eol + 1);
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            server->handle(*client, line);
+        }
+        if (client->in.size() > MAX_LINE) client->dead = true;
+        
+        server->sweep();
+    }
+    
+    void handle(Client& client, const std::string& line) {
+        std::istringstream words(line);
+        std::string command, list;
+        words >> command >> list;
+        
+        if (command == "PING") {
+            send_to(client, "PONG\n");
+        } else if (command == "SOURCE") {
+            if (list == "primary") {
+                client.follow = SOURCE_PRIMARY;
+            } else if (list == "all") {
+                client.follow = SOURCE_ALL;
+            } else {
+                try {
+                    unsigned long id = std::stoul(list);
+                    if (id >= SOURCE_PRIMARY) throw std::out_of_range("node id");
+                    client.follow = static_cast<uint32_t>(id);
+                } catch (...) {
+                    send_to(client, "ERR bad source " + list + "\n");
+                    return;
+                }
+            }
+            send_to(client, "OK " + list + "\n");
+        } else if (command == "UNSUBSCRIBE") {
+            client.fields = 0;
+            send_to(client, "OK\n");
+        } else if (command == "SET" || command == "CONFIG") {
+            send_to(client, on_control_(line));
+        } else if (command == "EVENTFD") {
+            send_eventfd(client, list);
+        } else if (command == "SUBSCRIBE") {
+            uint32_t fields = 0;
+            uint32_t bar_count = 0;
+            std::istringstream items(list);
+            std::string item;
+            while (std::getline(items, item, ',')) {
+                uint32_t field = parse_field(item, bar_count);
+                if (field == 0) {
+                    send_to(client, "ERR unknown field " + item + "\n");
+                    return;
+                }
+                fields |= field;
+            }
+            client.fields = fields;
+            client.bar_count = bar_count;
+            send_to(client, "OK " + list + "\n");
+        } else {
+            send_to(client, "ERR unknown command\n");
+        }
+        update_demand();
+    }
+    
+    static uint32_t parse_field(const std::string& name, uint32_t& bar_count) {
+        if (name == "bpm") return FIELD_BPM;
+        if (name == "confidence") return FIELD_CONFIDENCE;
+        if (name == "amplitude") return FIELD_AMPLITUDE;
+        if (name == "pitch") return FIELD_PITCH;
+        if (name == "beat") return FIELD_BEAT;
+        if (name == "stable") return FIELD_STABLE;
+        if (name == "average") return FIELD_AVERAGE;
+        if (name == "median") return FIELD_MEDIAN;
+        if (name == "octave") return FIELD_OCTAVE;
+        if (name == "deviation") return FIELD_DEVIATION;
+        if (name == "phase") return FIELD_PHASE;
+        if (name == "next") return FIELD_NEXT;
+        if (name == "all") return FIELD_ALL;
+        if (name == "bars") return FIELD_BARS;
+        if (name == "bands") return FIELD_BANDS;
+        if (name.compare(0, 5, "bars=") == 0) {
+            try {
+                unsigned long n = std::stoul(name.substr(5));
+                if (n < 1 || n > SpectrumBars::MAX_BARS) return 0;
+                bar_count = static_cast<uint32_t>(n);
+                return FIELD_BARS;
+            } catch (...) {
+                return 0;
+            }
+        }
+        return 0;
+    }
+    
+    // One U line into line_; `bar_count` bars, each the peak of the
+    // detector bars it covers
+    void format_update(const BeatSnapshot& snap, uint32_t beats, const std::array<uint32_t, BandOnsets::COUNT>& band_beats,
+                       uint32_t fields, uint32_t bar_count, uint64_t now_ns) {
+        TextLine& line = line_;
+        line.clear();
+        line << "U source=" << snap.source_id;
+        if (fields & FIELD_BPM) (line << " bpm=").fixed(snap.bpm, 2);
+        if (fields & FIELD_CONFIDENCE) (line << " confidence=").fixed(snap.confidence, 2);
+        if (fields & FIELD_AMPLITUDE) (line << " amplitude=").fixed(snap.amplitude, 4);
+        if (fields & FIELD_PITCH) (line << " pitch=").fixed(snap.pitch_hz, 2);
+        if (fields & FIELD_BEAT) line << " beat=" << beats;
+        if (fields & FIELD_STABLE) line << " stable=" << (snap.is_stable ? 1 : 0);
+        if (fields & FIELD_AVERAGE) (line << " average=").fixed(snap.average_bpm, 2);
+        if (fields & FIELD_MEDIAN) (line << " median=").fixed(snap.median_bpm, 2);
+        if (fields & FIELD_OCTAVE) (line << " octave=").fixed(snap.octave_bpm, 2);
+        if (fields & FIELD_DEVIATION) (line << " deviation=").fixed(snap.bpm_deviation, 2);
+        if (fields & FIELD_PHASE) (line << " phase=").fixed(snap.beat_phase, 3);
+        if (fields & FIELD_NEXT) {
+            if (snap.next_beat_ns) {
+                int64_t in_ns = static_cast<int64_t>(snap.next_beat_ns - now_ns);
+                line << " next=" << snap.next_beat_ns << " next_in=";
+                line.fixed(std::max<int64_t>(in_ns, 0) / 1e6, 1);
+            } else {
+                line << " next=-1 next_in=-1";
+            }
+        }
+        if ((fields & FIELD_BARS) && snap.bar_count > 0) {
+            line << " bars=";
+            for (uint32_t i = 0; i < bar_count; ++i) {
+                uint32_t begin = i * snap.bar_count / bar_count;
+                uint32_t end = std::max(begin + 1, (i + 1) * snap.bar_count / bar_count);
+                float value = *std::max_element(snap.bars + begin, snap.bars + end);
+                line << static_cast<int>(std::min(value, 1.0f) * 100.0f + 0.5f) << ';';
+            }
+        }
+        if ((fields & FIELD_BANDS) && snap.has_bands) {
+            for (uint32_t b = 0; b < BandOnsets::COUNT; ++b) line << ' ' << BandOnsets::BANDS[b].name << '=' << band_beats[b];
+            line << " bands=";
+            for (float level : snap.band_levels) line << static_cast<int>(std::min(level, 1.0f) * 100.0f + 0.5f) << ';';
+        }
+        line << '\n';
+    }
+    
+    void send_eventfd(Client& client, const std::string& which) {
+        uint32_t follow = client.follow;
+        if (which == "primary") {
+            follow = SOURCE_PRIMARY;
+        } else if (!which.empty()) {
+            try {
+                unsigned long id = std::stoul(which);
+                if (id >= SOURCE_PRIMARY) throw std::out_of_range("node id");
+                follow = static_cast<uint32_t>(id);
+            } catch (...) {
+                send_to(client, "ERR bad source " + which + "\n");
+                return;
+            }
+        }
+        if (follow == SOURCE_ALL) {
+            send_to(client, "ERR EVENTFD needs one source\n");
+            return;
+        }
+        int efd = eventfd_of_(follow, follow == SOURCE_PRIMARY);
+        if (efd < 0) {
+            send_to(client, "ERR no eventfd\n");
+            return;
+        }
+        
+        // The descriptor rides on the reply itself, so everything queued
+        // before it has to be out first
+        send_to(client, "");
+        if (client.dead) return;
+        if (!client.out.empty()) {
+            send_to(client, "ERR busy\n");
+            return;
+        }
+        
+        static const char reply[] = "OK eventfd\n";
+        iovec iov = {const_cast<char*>(reply), sizeof(reply) - 1};
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+        msghdr msg = {};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        std::memcpy(CMSG_DATA(cmsg), &efd, sizeof(int));
+        
+        ssize_t n = sendmsg(client.fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) client.dead = true;
+            else send_to(client, "ERR busy\n");
+        } else if (static_cast<size_t>(n) < iov.iov_len) {
+            // The descriptor went with the first byte; queue the rest of the line
+            client.out.append(reply + n, iov.iov_len - static_cast<size_t>(n));
+        }
+    }
+    
+    void send_to(Client& client, std::string_view data) {
+        if (client.dead) return;
+        client.out += data;
+        while (!client.out.empty()) {
+            ssize_t n = send(client.fd, client.out.data(), client.out.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+            if (n > 0) {
+                client.out.erase(0, static_cast<size_t>(n));
+            } else {
+                if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) client.dead = true;
+                break;
+            }
+        }
+        if (client.out.size() > MAX_BACKLOG) client.dead = true;
+    }
+    
+    void sweep() {
+        auto dead = std::remove_if(clients_.begin(), clients_.end(), [this](const std::unique_ptr<Client>& client) {
+            if (!client->dead) return false;
+            pw_loop_destroy_source(loop_, client->source);
+            close(client->fd);
+            return true;
+        });
+        if (dead == clients_.end()) return;
+        clients_.erase(dead, clients_.end());
+        update_demand();
+    }
+    
+    void update_demand() {
+        size_t count = std::count_if(clients_.begin(), clients_.end(),
+                                     [](const std::unique_ptr<Client>& client) { return client->fields != 0; });
+        if (count == subscribers_) return;
+        subscribers_ = count;
+        on_demand_(count);
+    }
+    
+    const std::string path_;
+    pw_loop* const loop_;
+    const int listen_fd_;
+    spa_source* listen_source_ = nullptr;
+    std::function<void(size_t)> on_demand_;
+    ControlHandler on_control_;
+    EventfdLookup eventfd_of_;
+    std::vector<std::unique_ptr<Client>> clients_;
+    TextLine line_;
+    size_t subscribers_ = 0;
+};
+
+// What the audio thread hands the main loop for subscribers, bars included
+struct SubscriberUpdate {
+    BeatSnapshot snap;
+    uint32_t beats = 0;
+    std::array<uint32_t, BandOnsets::COUNT> band_beats{};
+    std::array<float, SpectrumBars::MAX_BARS> bars{};
+};
+
+// Fixed-size beat record, pushed from the analysis path without formatting
+struct BeatRecord {
+    uint64_t time_ns;               // CLOCK_MONOTONIC
+    float bpm;
+    float confidence;
+    float pitch_hz;
+    float amplitude;
+    float variance;
+    uint32_t source_id;             // v2: PipeWire node id of the stream (reserved before)
+};
+static_assert(sizeof(BeatRecord) == 32, "BeatRecord layout is part of the binary log format");
+
+// Header of the binary log (.bdl): followed by packed BeatRecords until EOF.
+// The clock pair maps monotonic record times back to wall-clock time.
+struct BeatLogHeader {
+    static constexpr uint32_t MAGIC = 0x474c4442;  // "BDLG"
+    static constexpr uint32_t VERSION = 2;
+    
+    uint32_t magic;
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t reserved;
+    uint64_t realtime_base_ns;      // CLOCK_REALTIME ...
+    uint64_t monotonic_base_ns;     // ... at the same instant as CLOCK_MONOTONIC
+};
+static_assert(sizeof(BeatLogHeader) == 32, "BeatLogHeader layout is part of the binary log format");
+
+// Asynchronous beat logger. push() is a lock-free enqueue of a BeatRecord;
+// a background thread drains the queue every DRAIN_INTERVAL and writes the
+// batch as CSV or as the binary .bdl format, so the analysis path never
+// formats, allocates or touches the file. Each producer (one per capture
+// source) has its own queue; a drained batch is merged back into time order.
+class BeatLogger {
+public:
+    enum class Format { Csv, Binary };
+    
+    static constexpr size_t QUEUE_CAPACITY = 4096;
+    static constexpr auto DRAIN_INTERVAL = std::chrono::milliseconds(100);
+    
+    static std::unique_ptr<BeatLogger> create(const std::string& path, Format format, size_t producers = 1) {
+        std::unique_ptr<BeatLogger> logger(new BeatLogger(format, producers));
+        logger->file_.open(path, format == Format::Binary ? std::ios::binary : std::ios::out);
+        if (!logger->file_.is_open()) return nullptr;
+        
+        logger->header_ = {BeatLogHeader::MAGIC, BeatLogHeader::VERSION, sizeof(BeatRecord), 0,
+                           clock_ns(CLOCK_REALTIME), clock_ns(CLOCK_MONOTONIC)};
+        logger->utc_offset_ = utc_offset_s(logger->header_.realtime_base_ns);
+        if (format == Format::Binary) {
+            logger->file_.write(reinterpret_cast<const char*>(&logger->header_), sizeof(BeatLogHeader));
+        } else {
+            std::time_t now = static_cast<std::time_t>(logger->header_.realtime_base_ns / 1000000000ull);
+            logger->file_ << "# Beat Detection Log - " << std::put_time(std::localtime(&now), "%Y-%m-%d %H:%M:%S") << "\n";
+            logger->file_ << "# Timestamp,BPM,Confidence,Pitch(Hz),Amplitude,Variance,Source\n";
+        }
+        logger->file_.flush();
+        
+        logger->thread_ = std::thread(&BeatLogger::drain_loop, logger.get());
+        pthread_setname_np(logger->thread_.native_handle(), "bd-logger");
+        return logger;
+    }
+    
+    ~BeatLogger() {
+        running_ = false;
+        if (thread_.joinable()) thread_.join();
+        drain();
+    }
+    
+    BeatLogger(const BeatLogger&) = delete;
+    BeatLogger& operator=(const BeatLogger&) = delete;
+    
+    // Hot path: never blocks, never allocates. Full queue drops the record.
+    // Each producer index must only ever be pushed from one thread at a time.
+    void push(const BeatRecord& record, size_t producer = 0) {
+        if (queues_[producer]->write(&record, 1) == 0) {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    
+    uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+    
+    // Converts a binary log to the CSV layout on `out`. Returns false if the
+    // file is missing or not a beat log.
+    static bool convert_to_csv(const std::string& path, std::ostream& out) {
+        std::ifstream in(path, std::ios::binary);
+        BeatLogHeader header{};
+        if (!in.read(reinterpret_cast<char*>(&header), sizeof(header))
+            || header.magic != BeatLogHeader::MAGIC || header.record_size != sizeof(BeatRecord)) {
+            return false;
+        }
+        
+        out << "# Timestamp,BPM,Confidence,Pitch(Hz),Amplitude,Variance" << (header.version >= 2 ? ",Source" : "") << "\n";
+        const int64_t offset = utc_offset_s(header.realtime_base_ns);
+        BeatRecord record;
+        while (in.read(reinterpret_cast<char*>(&record), sizeof(record))) {
+            write_csv(out, header, offset, record);
+        }
+        return true;
+    }
+
+private:
+    BeatLogger(Format format, size_t producers)
+        : format_(format)
+    {
+        for (size_t i = 0; i < producers; ++i) {
+            queues_.push_back(std::make_unique<SpscRing<BeatRecord>>(QUEUE_CAPACITY));
+        }
+    }
+    
+    // Local time zone offset, looked up once per log rather than per record
+    static int64_t utc_offset_s(uint64_t wall_ns) {
+        std::time_t secs = static_cast<std::time_t>(wall_ns / 1000000000ull);
+        std::tm local{};
+        localtime_r(&secs, &local);
+        return local.tm_gmtoff;
+    }
+    
+    static void write_csv(std::ostream& out, const BeatLogHeader& header, int64_t utc_offset_s, const BeatRecord& r) {
+        uint64_t wall_ns = header.realtime_base_ns + (r.time_ns - header.monotonic_base_ns);
+        int64_t day_s = (static_cast<int64_t>(wall_ns / 1000000000ull) + utc_offset_s) % 86400;
+        unsigned ms = static_cast<unsigned>((wall_ns / 1000000ull) % 1000);
+        
+        out << std::setfill('0') << std::setw(2) << day_s / 3600 << ":" << std::setw(2) << day_s / 60 % 60
+            << ":" << std::setw(2) << day_s % 60 << "." << std::setw(3) << ms << std::setfill(' ') << ","
+            << std::fixed << std::setprecision(1) << r.bpm << ","
+            << std::setprecision(2) << r.confidence << ","
+            << r.pitch_hz << ","
+            << std::setprecision(4) << r.amplitude << ","
+            << r.variance;
+        if (header.version >= 2) out << "," << r.source_id;
+        out << "\n";
+    }
+    
+    void drain_loop() {
+        while (running_) {
+            std::this_thread::sleep_for(DRAIN_INTERVAL);
+            drain();
+        }
+    }
+    
+    void drain() {
+        BeatRecord batch[256];
+        size_t n;
+        pending_.clear();
+        for (auto& queue : queues_) {
+            while ((n = queue->read(batch, std::size(batch))) > 0) {
+                pending_.insert(pending_.end(), batch, batch + n);
+            }
+        }
+        if (pending_.empty()) return;
+        
+        if (queues_.size() > 1) {
+            std::stable_sort(pending_.begin(), pending_.end(),
+                             [](const BeatRecord& a, const BeatRecord& b) { return a.time_ns < b.time_ns; });
+        }
+        if (format_ == Format::Binary) {
+            file_.write(reinterpret_cast<const char*>(pending_.data()), pending_.size() * sizeof(BeatRecord));
+        } else {
+            for (const BeatRecord& record : pending_) write_csv(file_, header_, utc_offset_, record);
+        }
+        file_.flush();
+    }
+    
+    const Format format_;
+    std::ofstream file_;
+    BeatLogHeader header_{};
+    int64_t utc_offset_ = 0;
+    std::vector<std::unique_ptr<SpscRing<BeatRecord>>> queues_;
+    std::vector<BeatRecord> pending_;   // drain thread only
+    std::atomic<uint64_t> dropped_{0};
+    std::atomic<bool> running_{true};
+    std::thread thread_;
+};
+
+// Run-length latency histogram with fixed memory: log-linear buckets
+// (HDR-style), 32 linear sub-buckets per power of two, so any recorded
+// value is reported within ~3%. Covers 0 ns .. 2^40 ns (~18 min), larger
+// values land in the top bucket while max() stays exact. One thread records;
+// any thread may query percentiles while recording is in progress.
+class LatencyHistogram {
+public:
+    static constexpr int SUB_BITS = 5;
+    static constexpr uint64_t SUB_COUNT = 1ull << SUB_BITS;
+    static constexpr int MAX_MSB = 39;
+    static constexpr size_t BUCKETS = (MAX_MSB - SUB_BITS + 1) * SUB_COUNT + SUB_COUNT;
+    
+    LatencyHistogram() {
+        for (auto& c : counts_) c.store(0, std::memory_order_relaxed);
+    }
+    
+    void record(uint64_t ns) {
+        bump(counts_[bucket_of(ns)], 1);
+        bump(total_, 1);
+        bump(sum_ns_, ns);
+        if (ns > max_ns_.load(std::memory_order_relaxed)) max_ns_.store(ns, std::memory_order_relaxed);
+    }
+    
+    // Fold in the samples of another histogram, e.g. the one of a pipeline
+    // this one replaces; called by the writer
+    void merge(const LatencyHistogram& other) {
+        for (size_t i = 0; i < BUCKETS; ++i) bump(counts_[i], other.counts_[i].load(std::memory_order_relaxed));
+        bump(total_, other.count());
+        bump(sum_ns_, other.sum_ns_.load(std::memory_order_relaxed));
+        if (other.max_ns() > max_ns()) max_ns_.store(other.max_ns(), std::memory_order_relaxed);
+    }
+    
+    uint64_t count() const { return total_.load(std::memory_order_relaxed); }
+    uint64_t max_ns() const { return max_ns_.load(std::memory_order_relaxed); }
+    double mean_ns() const {
+        uint64_t n = count();
+        return n ? static_cast<double>(sum_ns_.load(std::memory_order_relaxed)) / n : 0.0;
+    }
+    
+    // Upper edge of the bucket that holds the requested quantile (0..1)
+    uint64_t percentile_ns(double q) const {
+        uint64_t n = count();
+        if (n == 0) return 0;
+        uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(q * n)));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < BUCKETS; ++i) {
+            seen += counts_[i].load(std::memory_order_relaxed);
+            if (seen >= rank) return std::min(bucket_upper(i), max_ns());
+        }
+        return max_ns();
+    }
+
+private:
+    // Single writer: a relaxed load+store is enough and avoids a locked add
+    static void bump(std::atomic<uint64_t>& a, uint64_t v) {
+        a.store(a.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+    }
+    
+    static size_t bucket_of(uint64_t v) {
+        if (v < SUB_COUNT) return static_cast<size_t>(v);
+        int msb = 63 - __builtin_clzll(v);
+        if (msb > MAX_MSB) return BUCKETS - 1;
+        int shift = msb - SUB_BITS;
+        uint64_t sub = (v >> shift) & (SUB_COUNT - 1);
+        return static_cast<size_t>((shift + 1) * SUB_COUNT + sub);
+    }
+    
+    static uint64_t bucket_upper(size_t i) {
+        if (i < SUB_COUNT) return i;
+        uint64_t shift = i / SUB_COUNT - 1;
+        uint64_t sub = i % SUB_COUNT;
+        return ((SUB_COUNT + sub + 1) << shift) - 1;
+    }
+    
+    std::atomic<uint64_t> counts_[BUCKETS];
+    std::atomic<uint64_t> total_{0};
+    std::atomic<uint64_t> sum_ns_{0};
+    std::atomic<uint64_t> max_ns_{0};
+};
+
+// Pipeline stages with their own latency histogram
+enum class Stage { Callback, Hop, Gate, Decimate, Spectrum, Tempo, Onset, Pitch, Output, Count };
+
+inline const char* stage_name(Stage stage) {
+    switch (stage) {
+        case Stage::Callback: return "callback";
+        case Stage::Hop: return "hop (total)";
+        case Stage::Gate: return "gate";
+        case Stage::Decimate: return "decimate";
+        case Stage::Spectrum: return "spectrum";
+        case Stage::Tempo: return "tempo";
+        case Stage::Onset: return "onset";
+        case Stage::Pitch: return "pitch";
+        case Stage::Output: return "output";
+        case Stage::Count: break;
+    }
+    return "?";
+}
+
+// Analysis levels under overload. Each level sheds one more stage, in the
+// order that costs detection least: pitch, then the visualiser bars, then
+// tempo tracking and band events, leaving onsets alone.
+enum class Degrade : uint8_t { Full, NoPitch, NoBars, OnsetOnly };
+constexpr size_t DEGRADE_LEVELS = 4;
+
+inline const char* degrade_name(Degrade level) {
+    switch (level) {
+        case Degrade::Full: return "full";
+        case Degrade::NoPitch: return "no pitch";
+        case Degrade::NoBars: return "no bars";
+        case Degrade::OnsetOnly: return "onset only";
+    }
+    return "?";
+}
+
+// Picks the analysis level from the backlog: one level deeper for every
+// `step` of audio waiting, straight away, and one level back after
+// RECOVER_S of analysed audio with less than half a step waiting. A step
+// of 0 keeps full analysis and only tracks the backlog. Written by the
+// analysing thread; the counters can be read from anywhere.
+class OverloadGovernor {
+public:
+    static constexpr double RECOVER_S = 2.0;
+    
+    OverloadGovernor(uint64_t step_ns, Degrade limit) : step_ns_(step_ns), limit_(limit) {}
+    
+    // `backlog_ns` of audio waiting before a block of `block_ns` is
+    // analysed; returns the level to analyse it at
+    Degrade update(uint64_t backlog_ns, uint64_t block_ns) {
+        if (backlog_ns > peak_backlog_ns_.load(std::memory_order_relaxed)) {
+            peak_backlog_ns_.store(backlog_ns, std::memory_order_relaxed);
+        }
+        backlog_ns_.store(backlog_ns, std::memory_order_relaxed);
+        
+        if (step_ns_ > 0) {
+            size_t wanted = std::min<size_t>(backlog_ns / step_ns_, static_cast<size_t>(limit_));
+            size_t current = static_cast<size_t>(level_);
+            if (wanted > current) {
+                level_ = static_cast<Degrade>(wanted);
+                calm_ns_ = 0;
+                escalations_.store(escalations_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            } else if (current > 0 && backlog_ns < step_ns_ / 2) {
+                calm_ns_ += block_ns;
+                if (calm_ns_ >= RECOVER_S * 1e9) {
+                    level_ = static_cast<Degrade>(current - 1);
+                    calm_ns_ = 0;
+                }
+            } else {
+                calm_ns_ = 0;
+            }
+        }
+        
+        auto& at_level = level_ns_[static_cast<size_t>(level_)];
+        at_level.store(at_level.load(std::memory_order_relaxed) + block_ns, std::memory_order_relaxed);
+        published_.store(level_, std::memory_order_relaxed);
+        return level_;
+    }
+    
+    bool enabled() const { return step_ns_ > 0; }
+    Degrade level() const { return published_.load(std::memory_order_relaxed); }
+    uint64_t backlog_ns() const { return backlog_ns_.load(std::memory_order_relaxed); }
+    uint64_t peak_backlog_ns() const { return peak_backlog_ns_.load(std::memory_order_relaxed); }
+    uint64_t escalations() const { return escalations_.load(std::memory_order_relaxed); }
+    uint64_t level_ns(Degrade level) const { return level_ns_[static_cast<size_t>(level)].load(std::memory_order_relaxed); }
+
+private:
+    const uint64_t step_ns_;
+    const Degrade limit_;
+    Degrade level_ = Degrade::Full;
+    uint64_t calm_ns_ = 0;
+    
+    std::atomic<Degrade> published_{Degrade::Full};
+    std::atomic<uint64_t> backlog_ns_{0};
+    std::atomic<uint64_t> peak_backlog_ns_{0};
+    std::atomic<uint64_t> escalations_{0};
+    std::array<std::atomic<uint64_t>, DEGRADE_LEVELS> level_ns_{};
+};
+
+// Streaming statistics over the last N beat BPMs. Mean and variance use
+// Welford's update together with its inverse for the value leaving the
+// window; the median comes from a sorted copy of the window, and an
+// octave-folded histogram gives the tempo with half/double-time errors
+// folded together. Queries are O(1); a push costs one binary search and a
+// short memmove on the sorted copy.
+template <size_t N>
+class BpmStatistics {
+public:
+    static constexpr float OCTAVE_LOW = 80.0f;      // tempi are folded into [80, 160)
+    static constexpr size_t OCTAVE_BINS = 80;       // 1 BPM per bin
+    
+    void push(float bpm) {
+        if (count_ == N) remove(window_[head_]);
+        window_[head_] = bpm;
+        head_ = (head_ + 1) % N;
+        add(bpm);
+    }
+    
+    bool empty() const { return count_ == 0; }
+    size_t size() const { return count_; }
+    float mean() const { return static_cast<float>(mean_); }
+    
+    // Population standard deviation, as the stability check always used
+    float stddev() const {
+        return count_ > 0 ? static_cast<float>(std::sqrt(std::max(m2_, 0.0) / count_)) : 0.0f;
+    }
+    
+    float median() const {
+        if (count_ == 0) return 0.0f;
+        size_t mid = count_ / 2;
+        return count_ % 2 ? sorted_[mid] : 0.5f * (sorted_[mid - 1] + sorted_[mid]);
+    }
+    
+    // Mean of the folded tempi in the fullest bin; 0 when nothing usable was seen
+    float octave_bpm() const {
+        return bins_[mode_] > 0 ? folded_sum_[mode_] / bins_[mode_] : 0.0f;
+    }
+
+private:
+    static size_t fold(float bpm, float& folded) {
+        if (!(bpm > 0.0f) || !std::isfinite(bpm)) return OCTAVE_BINS;   // not binned
+        while (bpm < OCTAVE_LOW) bpm *= 2.0f;
+        while (bpm >= 2.0f * OCTAVE_LOW) bpm *= 0.5f;
+        folded = bpm;
+        return std::min(static_cast<size_t>(bpm - OCTAVE_LOW), OCTAVE_BINS - 1);
+    }
+    
+    void add(float bpm) {
+        count_++;
+        double delta = bpm - mean_;
+        mean_ += delta / count_;
+        m2_ += delta * (bpm - mean_);
+        
+        auto end = sorted_.begin() + count_ - 1;
+        auto it = std::upper_bound(sorted_.begin(), end, bpm);
+        std::copy_backward(it, end, end + 1);
+        *it = bpm;
+        
+        float folded = 0.0f;
+        size_t bin = fold(bpm, folded);
+        if (bin < OCTAVE_BINS) {
+            bins_[bin]++;
+            folded_sum_[bin] += folded;
+            if (bins_[bin] > bins_[mode_]) mode_ = bin;
+        }
+    }
+    
+    void remove(float bpm) {
+        if (count_ == 1) {
+            mean_ = m2_ = 0.0;
+        } else {
+            double old_mean = mean_;
+            mean_ = (mean_ * count_ - bpm) / (count_ - 1);
+            m2_ -= (bpm - old_mean) * (bpm - mean_);
+        }
+        
+        auto it = std::lower_bound(sorted_.begin(), sorted_.begin() + count_, bpm);
+        std::copy(it + 1, sorted_.begin() + count_, it);
+        count_--;
+        
+        float folded = 0.0f;
+        size_t bin = fold(bpm, folded);
+        if (bin < OCTAVE_BINS) {
+            bins_[bin]--;
+            folded_sum_[bin] -= folded;
+            // Only losing a count from the peak bin can move the peak
+            if (bin == mode_) {
+                mode_ = std::max_element(bins_.begin(), bins_.end()) - bins_.begin();
+            }
+        }
+    }
+    
+    std::array<float, N> window_{};          // insertion order, oldest at head_ once full
+    std::array<float, N> sorted_{};          // first count_ entries, ascending
+    size_t head_ = 0;
+    size_t count_ = 0;
+    double mean_ = 0.0;
+    double m2_ = 0.0;
+    std::array<uint32_t, OCTAVE_BINS> bins_{};
+    std::array<float, OCTAVE_BINS> folded_sum_{};
+    size_t mode_ = 0;
+};
+
+// Phase-locked beat clock on top of the tempo and onset output. An
+// oscillator advances one hop at a time at the tracked beat period; every
+// confident beat is a phase measurement that nudges the phase (proportional
+// term) and the period (integral term) towards it. The tempo estimate seeds
+// the period and, once locked, only steers it gently so the beats decide
+// the exact period while the tempo keeps it from wandering off.
+// Beats are expected on whole phases, so skipped beats do not count as
+// errors. Everything runs in sample time, so offline runs predict exactly
+// like live capture.
+class BeatPhaseTracker {
+public:
+    static constexpr double PHASE_GAIN = 0.3;
+    static constexpr double PERIOD_GAIN = 0.1;
+    static constexpr double ACQUIRE_TEMPO_GAIN = 0.05;    // per hop with a valid tempo, before locking
+    static constexpr double LOCKED_TEMPO_GAIN = 0.0005;
+    static constexpr double UNLOCK_BEATS = 8.0;    // beat periods without a beat before the lock is dropped
+    
+    BeatPhaseTracker(uint32_t sample_rate, float min_bpm, float max_bpm)
+        : sample_rate_(sample_rate)
+        , min_period_(60.0 * sample_rate / max_bpm)
+        , max_period_(60.0 * sample_rate / min_bpm)
+    {}
+    
+    // `end` is the sample index just past a hop of `hop` samples; `bpm` is 0
+    // when there is no valid tempo for this hop
+    void update(uint64_t end, uint32_t hop, float bpm, bool is_beat) {
+        if (bpm > 0.0f) {
+            double target = 60.0 * sample_rate_ / bpm;
+            double gain = locked_ ? LOCKED_TEMPO_GAIN : ACQUIRE_TEMPO_GAIN;
+            period_ = period_ == 0.0 ? target : period_ + gain * (target - period_);
+        }
+        if (period_ == 0.0) return;
+        
+        double advance = hop / period_;
+        phase_ += advance;
+        if (is_beat) {
+            if (!locked_) {
+                phase_ = 0.0;
+                locked_ = true;
+            } else {
+                double error = phase_ - std::round(phase_);    // > 0: the oscillator ran ahead
+                phase_ -= PHASE_GAIN * error;
+                period_ = std::clamp(period_ * (1.0 + PERIOD_GAIN * error), min_period_, max_period_);
+            }
+            unconfirmed_ = 0.0;
+        } else if (locked_ && (unconfirmed_ += advance) > UNLOCK_BEATS) {
+            locked_ = false;
+        }
+        phase_ -= std::floor(phase_);
+        next_beat_ = end + static_cast<uint64_t>((1.0 - phase_) * period_ + 0.5);
+    }
+    
+    // Take over another tracker's lock, rescaled to this one's sample rate
+    void continue_from(const BeatPhaseTracker& other) {
+        const double ratio = static_cast<double>(sample_rate_) / other.sample_rate_;
+        period_ = other.period_ == 0.0 ? 0.0 : std::clamp(other.period_ * ratio, min_period_, max_period_);
+        phase_ = other.phase_;
+        unconfirmed_ = other.unconfirmed_;
+        locked_ = other.locked_;
+        next_beat_ = static_cast<uint64_t>(other.next_beat_ * ratio);
+    }
+    
+    bool locked() const { return locked_; }
+    float phase() const { return locked_ ? static_cast<float>(phase_) : 0.0f; }
+    float period_ms() const { return static_cast<float>(period_ * 1000.0 / sample_rate_); }
+    uint64_t next_beat_sample() const { return locked_ ? next_beat_ : 0; }
+
+private:
+    const uint32_t sample_rate_;
+    const double min_period_;
+    const double max_period_;
+    double period_ = 0.0;           // samples per beat, 0 until the first tempo
+    double phase_ = 0.0;            // beats since the last predicted beat, [0, 1)
+    double unconfirmed_ = 0.0;
+    bool locked_ = false;
+    uint64_t next_beat_ = 0;
+};
+
+// Everything the command line can configure
+struct DetectorOptions {
+    uint32_t buffer_size = 128;
+    OnsetEngine engine = OnsetEngine::Aubio;
+    uint32_t decimation = 1;                // --decimate: tempo path runs at rate / decimation
+    bool enable_logging = true;
+    bool enable_performance_stats = true;
+    bool enable_pitch_detection = false;
+    float pitch_rate_hz = 10.0f;            // --pitch-rate: estimates per second besides beats, 0 = beats only
+    bool enable_visual_feedback = true;
+    bool lock_memory = true;                // --no-mlock: leave the process pageable
+    bool enable_worker = false;
+    std::string shm_name;
+    float shm_rate_hz = 60.0f;
+    bool shm_eventfd = false;
+    uint32_t bar_count = 0;
+    bool enable_bands = false;              // --bands: kick/snare/hat events
+    bool bars_stdout = false;
+    float bars_fps = 30.0f;
+    BeatLogger::Format log_format = BeatLogger::Format::Csv;
+    float stats_interval_s = 0.0f;
+    float idle_after_s = 10.0f;             // 0 disables idle mode
+    float record_s = 0.0f;                  // --record: flight recorder length, 0 = off
+    uint32_t quantum_hops = 0;              // request hops * buffer_size frames per callback, 0 = graph default
+    std::vector<std::string> targets;       // --target: nodes to capture, the default sink when empty
+    unsigned pool_threads = 0;              // --pool: analysis workers, 0 = one per source up to the core count
+    float degrade_step_ms = 100.0f;         // --degrade: backlog per shed stage, 0 = never degrade
+    Degrade degrade_limit = Degrade::OnsetOnly;  // --degrade-limit: deepest level allowed
+    int rt_priority = 0;                    // --rt-priority: SCHED_FIFO for the analysis workers, 0 = off
+    std::vector<int> worker_cpus;           // --worker-cpus: analysis worker affinity, empty = any
+    std::vector<int> renderer_cpus;         // --renderer-cpus: console renderer affinity
+    std::string daemon_socket;              // --daemon: serve subscribers on this Unix socket
+    float daemon_rate_hz = 60.0f;
+    std::vector<std::string> input_files;   // offline mode when non-empty
+    unsigned jobs = 1;
+    bool bench = false;                     // --bench: per-stage micro-benchmark
+    std::string bench_file;                 // real-audio input for --bench, synthetic when empty
+};
+
+// Outcome of analysing one hop, handed to the HopListener
+struct HopResult {
+    uint64_t frame = 0;             // 1-based hop counter
+    uint64_t sample_index = 0;      // first sample of the hop, counted from the start of analysis
+    uint64_t time_ns = 0;           // CLOCK_MONOTONIC capture time of the hop's last sample, 0 if unknown
+    float amplitude = 0.0f;         // peak |x|
+    float rms = 0.0f;
+    bool silent = false;            // below the silence gate; nothing else was computed
+    float bpm = 0.0f;               // smoothed
+    float confidence = 0.0f;
+    float pitch_hz = 0.0f;          // latest estimate from the pitch worker (--pitch)
+    bool pitch_fresh = false;       // an estimate arrived on this hop ...
+    uint64_t pitch_sample_index = 0;  // ... for the hop starting at this sample
+    bool is_onset = false;
+    bool is_beat = false;
+    float variance = 0.0f;          // BPM deviation over the stability window
+    bool is_stable = false;
+    float average_bpm = 0.0f;       // over the beat history
+    float median_bpm = 0.0f;
+    float octave_bpm = 0.0f;        // history folded into [80, 160) BPM
+    float beat_phase = 0.0f;        // 0..1 from the phase tracker, 0 while unlocked
+    float beat_period_ms = 0.0f;
+    uint64_t next_beat_sample = 0;  // predicted next beat on the sample_index timeline, 0 while unlocked
+    uint32_t band_events = 0;       // BandOnsets::BAND_ bits, onsets of the previous hop (--bands)
+    std::array<float, BandOnsets::COUNT> band_levels{};
+    bool flight_dump = false;       // the flight recorder froze on this hop and wants dumping
+};
+
+class HopListener {
+public:
+    virtual ~HopListener() = default;
+    virtual void on_hop(const HopResult& hop) = 0;
+};
+
+// Hop decisions as kept by the flight recorder and stored in its dumps
+struct FlightHop {
+    static constexpr uint32_t FLAG_SILENT = 1u << 0;
+    static constexpr uint32_t FLAG_ONSET = 1u << 1;
+    static constexpr uint32_t FLAG_BEAT = 1u << 2;
+    
+    uint64_t sample_index;          // first sample of the hop; in a dump, counted from its first sample
+    float amplitude;
+    float confidence;
+    float bpm;
+    uint32_t flags;
+};
+static_assert(sizeof(FlightHop) == 24, "FlightHop layout is part of the flight dump format");
+
+// Header of the "bdfr" chunk a flight dump carries ahead of its WAV data,
+// followed by hop_count FlightHop entries. Other WAV readers skip it.
+struct FlightHeader {
+    static constexpr uint32_t VERSION = 1;
+    static constexpr uint32_t REASON_SIGNAL = 0;
+    static constexpr uint32_t REASON_ANOMALY = 1;
+    
+    uint32_t version;
+    uint32_t hop_size;
+    uint32_t decimation;
+    uint32_t engine;                // OnsetEngine
+    uint32_t hop_count;
+    uint32_t reason;
+    uint64_t first_sample;          // analyser sample index of the dump's first sample
+    uint64_t trigger_ns;            // CLOCK_MONOTONIC
+};
+static_assert(sizeof(FlightHeader) == 40, "FlightHeader layout is part of the flight dump format");
+
+// Flight recorder (--record): the last few seconds of analysed samples and
+// per-hop decisions in two preallocated rings, so an incident can be
+// replayed offline. The analysing thread records; a dump freezes the rings
+// at a hop boundary (on request, or on an anomaly: a stretch of loud audio
+// without beats after the tracker had been finding them), the main loop
+// writes them out as a WAV file that --input reads, then recording resumes.
+class FlightRecorder {
+public:
+    static constexpr double ANOMALY_SECONDS = 4.0;  // loud audio without a beat
+    static constexpr uint32_t ANOMALY_MIN_BEATS = 8;
+    
+    FlightRecorder(float seconds, uint32_t sample_rate, uint32_t hop_size, uint32_t decimation, OnsetEngine engine)
+        : sample_rate_(sample_rate)
+        , hop_size_(hop_size)
+        , decimation_(decimation)
+        , engine_(engine)
+        , samples_(static_cast<size_t>(seconds * sample_rate))
+        , hops_(samples_.size() / hop_size + 1)
+    {}
+    
+    FlightRecorder(const FlightRecorder&) = delete;
+    FlightRecorder& operator=(const FlightRecorder&) = delete;
+    
+    float seconds() const { return static_cast<float>(samples_.size()) / sample_rate_; }
+    
+    // Analysing thread
+    void record_samples(const float* data, uint32_t n) {
+        if (state_.load(std::memory_order_relaxed) == State::Frozen) {
+            position_ += n;
+            gap_ = true;
+            return;
+        }
+        if (gap_) {
+            valid_from_ = position_;        // samples before the freeze are stale now
+            gap_ = false;
+        }
+        const size_t cap = samples_.size();
+        for (uint32_t done = 0; done < n; ) {
+            size_t at = position_ % cap;
+            size_t run = std::min<size_t>(n - done, cap - at);
+            std::memcpy(samples_.data() + at, data + done, run * sizeof(float));
+            done += run;
+            position_ += run;
+        }
+    }
+    
+    // Analysing thread, once per hop. Returns true when the rings have just
+    // been frozen and the main loop should dump them.
+    bool record_hop(const HopResult& hop) {
+        State state = state_.load(std::memory_order_acquire);
+        if (state == State::Frozen) return false;
+        
+        FlightHop& entry = hops_[hop_count_++ % hops_.size()];
+        entry.sample_index = hop.sample_index;
+        entry.amplitude = hop.amplitude;
+        entry.confidence = hop.confidence;
+        entry.bpm = hop.bpm;
+        entry.flags = (hop.silent ? FlightHop::FLAG_SILENT : 0) | (hop.is_onset ? FlightHop::FLAG_ONSET : 0)
+                    | (hop.is_beat ? FlightHop::FLAG_BEAT : 0);
+        
+        if (state == State::Requested) {
+            reason_ = FlightHeader::REASON_SIGNAL;
+        } else if (anomaly(hop)) {
+            reason_ = FlightHeader::REASON_ANOMALY;
+        } else {
+            return false;
+        }
+        trigger_ns_ = hop.time_ns ? hop.time_ns : clock_ns(CLOCK_MONOTONIC);
+        frozen_position_ = position_;
+        state_.store(State::Frozen, std::memory_order_release);
+        return true;
+    }
+    
+    // Main loop: ask for a dump at the next hop
+    void request() {
+        State expected = State::Recording;
+        state_.compare_exchange_strong(expected, State::Requested, std::memory_order_acq_rel);
+    }
+    
+    // Main loop: write the frozen rings to `path` and resume recording
+    bool dump(const std::string& path) {
+        if (state_.load(std::memory_order_acquire) != State::Frozen) return false;
+        bool ok = write_dump(path);
+        state_.store(State::Recording, std::memory_order_release);
+        return ok;
+    }
+    
+    uint32_t last_reason() const { return reason_; }
+
+private:
+    enum class State : uint32_t { Recording, Requested, Frozen };
+    
+    bool anomaly(const HopResult& hop) {
+        if (hop.is_beat) {
+            beats_++;
+            loud_since_beat_ = 0;
+            return false;
+        }
+        if (hop.silent) {
+            loud_since_beat_ = 0;
+            return false;
+        }
+        loud_since_beat_ += hop_size_;
+        bool cooled_down = position_ - last_anomaly_ >= samples_.size();
+        if (beats_ < ANOMALY_MIN_BEATS || !cooled_down || loud_since_beat_ < ANOMALY_SECONDS * sample_rate_) return false;
+        last_anomaly_ = position_;
+        beats_ = 0;
+        loud_since_beat_ = 0;
+        return true;
+    }
+    
+    bool write_dump(const std::string& path) const {
+        const uint64_t end = frozen_position_;
+        const size_t count = std::min<uint64_t>(end - valid_from_, samples_.size());
+        const uint64_t first = end - count;
+        
+        std::vector<FlightHop> hops;
+        for (uint64_t i = hop_count_ > hops_.size() ? hop_count_ - hops_.size() : 0; i < hop_count_; ++i) {
+            FlightHop hop = hops_[i % hops_.size()];
+            if (hop.sample_index < first) continue;
+            hop.sample_index -= first;
+            hops.push_back(hop);
+        }
+        
+        FlightHeader header{FlightHeader::VERSION, hop_size_, decimation_, static_cast<uint32_t>(engine_),
+                            static_cast<uint32_t>(hops.size()), reason_, first, trigger_ns_};
+        const uint32_t fmt_size = 16;
+        const uint32_t flight_size = sizeof(FlightHeader) + hops.size() * sizeof(FlightHop);
+        const uint32_t data_size = count * sizeof(float);
+        const size_t file_size = 12 + (8 + fmt_size) + (8 + flight_size) + (8 + data_size);
+        
+        int fd = open(path.c_str(), O_CREAT | O_TRUNC | O_RDWR | O_CLOEXEC, 0644);
+        if (fd < 0) return false;
+        void* map = ftruncate(fd, file_size) == 0
+            ? mmap(nullptr, file_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+        int err = errno;
+        close(fd);
+        if (map == MAP_FAILED) {
+            errno = err;
+            return false;
+        }
+        
+        char* p = static_cast<char*>(map);
+        auto put = [&p](const void* data, size_t n) { std::memcpy(p, data, n); p += n; };
+        auto put_u32 = [&put](uint32_t v) { put(&v, 4); };
+        auto put_u16 = [&put](uint16_t v) { put(&v, 2); };
+        
+        put("RIFF", 4);
+        put_u32(static_cast<uint32_t>(file_size - 8));
+        put("WAVE", 4);
+        put("fmt ", 4);
+        put_u32(fmt_size);
+        put_u16(3);                                 // IEEE float
+        put_u16(1);
+        put_u32(sample_rate_);
+        put_u32(sample_rate_ * sizeof(float));
+        put_u16(sizeof(float));
+        put_u16(32);
+        put("bdfr", 4);
+        put_u32(flight_size);
+        put(&header, sizeof(header));
+        put(hops.data(), hops.size() * sizeof(FlightHop));
+        put("data", 4);
+        put_u32(data_size);
+        
+        // Oldest sample first
+        const size_t cap = samples_.size();
+        const size_t start = first % cap;
+        const size_t head = std::min(count, cap - start);
+        put(samples_.data() + start, head * sizeof(float));
+        put(samples_.data(), (count - head) * sizeof(float));
+        
+        munmap(map, file_size);
+        return true;
+    }
+    
+    const uint32_t sample_rate_;
+    const uint32_t hop_size_;
+    const uint32_t decimation_;
+    const OnsetEngine engine_;
+    std::vector<float> samples_;
+    std::vector<FlightHop> hops_;
+    std::atomic<State> state_{State::Recording};
+    
+    // Written by the analysing thread while recording; the main loop reads
+    // them only while frozen
+    uint64_t position_ = 0;         // samples seen, frozen or not
+    uint64_t valid_from_ = 0;       // first sample still in the ring since the last freeze
+    bool gap_ = false;
+    uint64_t frozen_position_ = 0;
+    uint64_t hop_count_ = 0;
+    uint64_t trigger_ns_ = 0;
+    uint32_t reason_ = FlightHeader::REASON_SIGNAL;
+    
+    // Anomaly trigger
+    uint32_t beats_ = 0;
+    uint64_t loud_since_beat_ = 0;
+    uint64_t last_anomaly_ = 0;
+};
+
+// The analysis pipeline for one audio stream: hop assembly, silence gate,
+// shared spectrum, tempo, onset, pitch, bars and BPM smoothing. It does not
+// know where samples come from, so live capture and offline files run the
+// exact same code.
+class BeatAnalyzer {
+public:
+    static constexpr float SILENCE_THRESHOLD = 0.01f;  // -40dB
+    static constexpr float BPM_MIN = 60.0f;
+    static constexpr float BPM_MAX = 200.0f;
+    static constexpr float CONFIDENCE_THRESHOLD = 0.5f;
+    static constexpr float BPM_VARIANCE_LIMIT = 5.0f;
+    static constexpr size_t BPM_HISTORY_SIZE = 20;
+    static constexpr size_t STABILITY_WINDOW = 5;
+    
+    static constexpr uint32_t MIN_DECIMATED_HOP = 16;
+    
+    // Detection thresholds that can change while the analyser runs
+    struct Tuning {
+        float silence_gate = SILENCE_THRESHOLD;     // peak amplitude below which a hop is silent
+        float onset_threshold = 0.15f;              // adaptive: this * (1 + rms), at most twice this
+        float tempo_threshold = 0.2f;
+        float confidence = CONFIDENCE_THRESHOLD;    // tempo confidence a beat needs
+        float min_ioi_ms = 25.0f;                   // shortest gap between onsets
+    };
+    
+    BeatAnalyzer(uint32_t buf_size, uint32_t sample_rate, OnsetEngine engine, uint32_t decimation,
+                 bool enable_pitch_detection, uint32_t bar_count, bool enable_bands, bool enable_performance_stats,
+                 HopListener* listener)
+        : buf_size_(buf_size)
+        , fft_size_(buf_size * 8)
+        , sample_rate_(sample_rate)
+        , engine_(engine)
+        , decimation_(decimation)
+        , enable_pitch_detection_(enable_pitch_detection)
+        , enable_performance_stats_(enable_performance_stats)
+        , bar_count_(bar_count)
+        , enable_bands_(enable_bands)
+        , listener_(listener)
+        , gate_kernels_(gate_kernels::select(buf_size))
+        , accumulated_samples_(0)
+        , samples_seen_(0)
+        , frame_count_(0)
+        , total_beats_(0)
+        , total_onsets_(0)
+        , phase_(sample_rate, BPM_MIN, BPM_MAX)
+        , smoothed_bpm_(0.0f)
+        , ns_per_sample_(1e9 / sample_rate)
+        , hop_time_ns_(0)
+        , stage_mark_ns_(0)
+        , hop_start_ns_(0)
+    {
+        sample_accumulator_.resize(buf_size_);
+    }
+    
+    BeatAnalyzer(const BeatAnalyzer&) = delete;
+    BeatAnalyzer& operator=(const BeatAnalyzer&) = delete;
+    
+    // The decimated hop must divide evenly and keep MIN_DECIMATED_HOP samples
+    static bool check_decimation(uint32_t buf_size, uint32_t decimation) {
+        if (decimation <= 1 || (buf_size % decimation == 0 && buf_size / decimation >= MIN_DECIMATED_HOP)) return true;
+        std::cerr << " Buffer size " << buf_size << " cannot be decimated by " << decimation
+                  << " (needs a multiple with at least " << MIN_DECIMATED_HOP << " samples per hop)" << std::endl;
+        return false;
+    }
+    
+    bool initialize() {
+        // Tempo and onsets only need the low end, so --decimate runs them on a
+        // low-passed, decimated copy with its own (smaller) front-end
+        uint32_t tempo_hop = buf_size_;
+        uint32_t tempo_rate = sample_rate_;
+        if (decimation_ > 1) {
+            if (!check_decimation(buf_size_, decimation_)) return false;
+            tempo_hop = buf_size_ / decimation_;
+            tempo_rate = sample_rate_ / decimation_;
+            decimator_ = std::make_unique<Decimator>(decimation_, buf_size_);
+            decimated_.assign(tempo_hop, 0.0f);
+            decimated_view_.length = tempo_hop;
+            decimated_view_.data = decimated_.data();
+            decimated_frontend_ = SpectralFrontEnd::create(fft_size_ / decimation_, tempo_hop, engine_);
+            if (!decimated_frontend_) {
+                std::cerr << " Failed to create decimated spectral front-end" << std::endl;
+                return false;
+            }
+        }
+        
+        // Shared window + FFT, computed once per hop; only needed for bars,
+        // bands and pitch when detection runs decimated
+        if (!decimator_ || enable_pitch_detection_ || bar_count_ > 0 || enable_bands_) {
+            frontend_ = SpectralFrontEnd::create(fft_size_, buf_size_, engine_);
+            if (!frontend_) {
+                std::cerr << " Failed to create spectral front-end" << std::endl;
+                return false;
+            }
+        }
+        
+        // Tempo tracking on the HFC (or flux) detection function
+        tempo_ = TempoTracker::create(tempo_hop, tempo_rate);
+        if (!tempo_) {
+            std::cerr << " Failed to create tempo tracker" << std::endl;
+            return false;
+        }
+        tempo_->set_threshold(tuning_.tempo_threshold);      // More sensitive
+        
+        // Onset detection on the log-compressed HFC (or flux) detection function
+        onset_ = OnsetPicker::create(tempo_hop, tempo_rate, engine_);
+        if (!onset_) {
+            std::cerr << " Failed to create onset detector" << std::endl;
+            return false;
+        }
+        onset_->set_threshold(0.2f);                         // Onset sensitivity
+        onset_->set_minioi_ms(tuning_.min_ioi_ms);           // Min 25ms between beats
+        onset_->set_silence(-45.0f);                         // Only process above -45dB
+        
+        // Pitch detection reads the same spectrum, so it adds no FFT, and
+        // runs on its own thread
+        if (enable_pitch_detection_) {
+            pitch_worker_ = std::make_unique<PitchWorker>(fft_size_, sample_rate_);
+            pitch_interval_ = pitch_rate_hz_ > 0.0f ? static_cast<uint64_t>(sample_rate_ / pitch_rate_hz_) : 0;
+        }
+        
+        // Visualiser bars come from the same spectrum as well
+        if (bar_count_ > 0) {
+            bars_ = std::make_unique<SpectrumBars>(bar_count_, fft_size_, buf_size_, sample_rate_);
+        }
+        
+        // And kick/snare/hat events, at full rate so the hat band is there
+        if (enable_bands_) {
+            bands_ = std::make_unique<BandOnsets>(fft_size_, buf_size_, sample_rate_);
+        }
+        
+        return true;
+    }
+    
+    // `capture_ns` is the CLOCK_MONOTONIC capture time of audio_data[0], 0 if
+    // unknown; hops are stamped from it by their offset into the block
+    void feed_samples(const float* audio_data, uint32_t n_samples, uint64_t capture_ns = 0) {
+        if (recorder_) recorder_->record_samples(audio_data, n_samples);
+        const float* const block = audio_data;
+        auto stamp = [&](const float* hop_end) {
+            hop_time_ns_ = capture_ns ? capture_ns + static_cast<uint64_t>((hop_end - block - 1) * ns_per_sample_) : 0;
+        };
+        
+        // Complete a pending partial hop with one block copy (gate measured on the way)
+        if (accumulated_samples_ > 0) {
+            uint32_t take = std::min(n_samples, buf_size_ - accumulated_samples_);
+            stage_start();
+            accumulated_gate_.merge(gate_kernels_.copy_measure(
+                sample_accumulator_.data() + accumulated_samples_, audio_data, take));
+            accumulated_samples_ += take;
+            audio_data += take;
+            n_samples -= take;
+            
+            if (accumulated_samples_ < buf_size_) return;
+            hop_start_ns_ = stage_mark_ns_;
+            stage_lap(Stage::Gate);
+            stamp(audio_data);
+            analyze_hop(sample_accumulator_.data(), accumulated_gate_);
+            accumulated_samples_ = 0;
+        }
+        
+        // Whole hops are analysed in place, without copying
+        while (n_samples >= buf_size_) {
+            stage_start();
+            hop_start_ns_ = stage_mark_ns_;
+            GateStats gate = gate_kernels_.measure_hop(audio_data, buf_size_);
+            stage_lap(Stage::Gate);
+            stamp(audio_data + buf_size_);
+            analyze_hop(audio_data, gate);
+            audio_data += buf_size_;
+            n_samples -= buf_size_;
+        }
+        
+        // Keep the leftover for the next quantum
+        if (n_samples > 0) {
+            accumulated_gate_ = gate_kernels_.copy_measure(sample_accumulator_.data(), audio_data, n_samples);
+            accumulated_samples_ = n_samples;
+        }
+    }
+    
+    uint32_t buf_size() const { return buf_size_; }
+    uint32_t fft_size() const { return fft_size_; }
+    uint32_t sample_rate() const { return sample_rate_; }
+    uint64_t frame_count() const { return frame_count_; }
+    uint64_t total_beats() const { return total_beats_; }
+    bool has_bpm_history() const { return !history_.empty(); }
+    const BpmStatistics<BPM_HISTORY_SIZE>& history() const { return history_; }
+    const char* gate_kernel_name() const { return gate_kernels_.name; }
+    bool fixed_hop() const { return gate_kernels_.hop != 0; }
+    OnsetEngine engine() const { return engine_; }
+    const char* flux_kernel_name() const { return detection().flux_kernel_name(); }
+    uint32_t decimation() const { return decimation_; }
+    
+    // Pitch estimates per second besides the beats (--pitch-rate), set before initialize()
+    void set_pitch_rate(float hz) { pitch_rate_hz_ = hz; }
+    const PitchWorker* pitch_worker() const { return pitch_worker_.get(); }
+    
+    // Overload shedding (OverloadGovernor), set by the analysing thread between blocks
+    void set_degrade(Degrade level) { degrade_ = level; }
+    
+    // Before initialize(), or by the analysing thread between blocks
+    void set_tuning(const Tuning& tuning) {
+        tuning_ = tuning;
+        if (tempo_) tempo_->set_threshold(tuning.tempo_threshold);
+        if (onset_) onset_->set_minioi_ms(tuning.min_ioi_ms);
+    }
+    const Tuning& tuning() const { return tuning_; }
+    
+    // Analysing thread, when this analyser takes over from `previous` (new
+    // settings or a new graph rate): BPM history, smoothing, phase lock,
+    // counters and the sample timeline continue, so the output stays steady
+    // while the new tempo tracker primes
+    void carry_over(const BeatAnalyzer& previous) {
+        const double ratio = static_cast<double>(sample_rate_) / previous.sample_rate_;
+        samples_seen_ = static_cast<uint64_t>(previous.samples_seen_ * ratio);
+        next_pitch_sample_ = static_cast<uint64_t>(previous.next_pitch_sample_ * ratio);
+        frame_count_ = previous.frame_count_;
+        total_beats_ = previous.total_beats_;
+        total_onsets_ = previous.total_onsets_;
+        history_ = previous.history_;
+        stability_ = previous.stability_;
+        smoothed_bpm_ = previous.smoothed_bpm_;
+        phase_.continue_from(previous.phase_);
+        latest_pitch_ = previous.latest_pitch_;
+        degrade_ = previous.degrade_;
+        for (size_t i = 0; i < latency_.size(); ++i) latency_[i].merge(previous.latency_[i]);
+    }
+    
+    // Flight recorder (--record), attached before the analyser is first used
+    void set_recorder(std::unique_ptr<FlightRecorder> recorder) { recorder_ = std::move(recorder); }
+    FlightRecorder* recorder() const { return recorder_.get(); }
+    const char* fir_kernel_name() const { return decimator_ ? decimator_->kernel_name() : "none"; }
+    const SpectrumBars* bars() const { return bars_.get(); }
+    const BandOnsets* bands() const { return bands_.get(); }
+    
+    float get_average_bpm() const { return history_.mean(); }
+    
+    // The RT callback is timed by whoever owns it and passed in as `callback`
+    void print_latency_report(std::ostream& out, const LatencyHistogram* callback = nullptr) const {
+        if (latency_[static_cast<size_t>(Stage::Hop)].count() == 0
+            && (!callback || callback->count() == 0)) return;
+        
+        auto ms = [](double ns) { return ns / 1e6; };
+        out << "   ⚡ Latency (ms)     " << std::setw(10) << "count" << std::setw(9) << "mean"
+            << std::setw(9) << "p50" << std::setw(9) << "p99" << std::setw(9) << "p99.9"
+            << std::setw(9) << "max" << std::endl;
+        for (size_t i = 0; i < latency_.size(); ++i) {
+            const LatencyHistogram& h = (i == static_cast<size_t>(Stage::Callback) && callback) ? *callback : latency_[i];
+            if (h.count() == 0) continue;
+            out << "      " << std::left << std::setw(13) << stage_name(static_cast<Stage>(i)) << std::right
+                << std::setw(10) << h.count() << std::fixed << std::setprecision(3)
+                << std::setw(9) << ms(h.mean_ns())
+                << std::setw(9) << ms(h.percentile_ns(0.50))
+                << std::setw(9) << ms(h.percentile_ns(0.99))
+                << std::setw(9) << ms(h.percentile_ns(0.999))
+                << std::setw(9) << ms(h.max_ns()) << std::endl;
+        }
+    }
+
+private:
+    // The front-end whose detection functions drive tempo and onsets
+    const SpectralFrontEnd& detection() const { return decimator_ ? *decimated_frontend_ : *frontend_; }
+    SpectralFrontEnd& detection() { return decimator_ ? *decimated_frontend_ : *frontend_; }
+    
+    float get_bpm_variance() const {
+        return stability_.empty() ? 999.0f : stability_.stddev();
+    }
+    
+    // History numbers are O(1) to read, so every hop carries them
+    void fill_statistics(HopResult& result) const {
+        result.variance = get_bpm_variance();
+        result.is_stable = result.variance < BPM_VARIANCE_LIMIT;
+        result.average_bpm = history_.mean();
+        result.median_bpm = history_.median();
+        result.octave_bpm = history_.octave_bpm();
+    }
+    
+    // The phase tracker only follows a plausible tempo
+    void update_phase(HopResult& result) {
+        float bpm = result.bpm > BPM_MIN && result.bpm < BPM_MAX ? result.bpm : 0.0f;
+        phase_.update(result.sample_index + buf_size_, buf_size_, result.silent ? 0.0f : bpm, result.is_beat);
+        result.beat_phase = phase_.phase();
+        result.beat_period_ms = phase_.period_ms();
+        result.next_beat_sample = phase_.next_beat_sample();
+    }
+    
+    // Pitch arrives hops after it was asked for; every hop carries the latest
+    void poll_pitch(HopResult& result) {
+        if (!pitch_worker_) return;
+        PitchWorker::Estimate estimate;
+        if (pitch_worker_->poll(estimate)) {
+            latest_pitch_ = estimate.pitch_hz;
+            result.pitch_fresh = true;
+            result.pitch_sample_index = estimate.sample_index;
+        }
+        result.pitch_hz = latest_pitch_;
+    }
+    
+    // Stage timing: each lap records the time since the previous mark
+    void stage_start() {
+        if (enable_performance_stats_) stage_mark_ns_ = clock_ns(CLOCK_MONOTONIC);
+    }
+    
+    void stage_lap(Stage stage) {
+        if (!enable_performance_stats_) return;
+        uint64_t now = clock_ns(CLOCK_MONOTONIC);
+        latency_[static_cast<size_t>(stage)].record(now - stage_mark_ns_);
+        stage_mark_ns_ = now;
+    }
+    
+    void hop_done() {
+        if (!enable_performance_stats_) return;
+        latency_[static_cast<size_t>(Stage::Hop)].record(clock_ns(CLOCK_MONOTONIC) - hop_start_ns_);
+    }
+    
+    void analyze_hop(const float* hop, const GateStats& gate) {
+        // aubio only reads its input, so a view onto the source samples is enough
+        fvec_t hop_view;
+        hop_view.length = buf_size_;
+        hop_view.data = const_cast<float*>(hop);
+        
+        HopResult result;
+        result.frame = ++frame_count_;
+        result.sample_index = samples_seen_;
+        result.time_ns = hop_time_ns_;
+        samples_seen_ += buf_size_;
+        
+        // Check signal amplitude to gate silence
+        result.amplitude = gate.peak;
+        result.rms = std::sqrt(gate.sum_sq / buf_size_);
+        result.bpm = smoothed_bpm_;
+        poll_pitch(result);
+        
+        // Only process if above silence threshold
+        if (result.amplitude < tuning_.silence_gate) {
+            result.silent = true;
+            update_phase(result);
+            fill_statistics(result);
+            if (bars_) bars_->decay();
+            if (bands_) {
+                bands_->decay();
+                std::copy_n(bands_->levels(), BandOnsets::COUNT, result.band_levels.begin());
+            }
+            if (recorder_) result.flight_dump = recorder_->record_hop(result);
+            listener_->on_hop(result);
+            stage_lap(Stage::Output);
+            hop_done();
+            return;
+        }
+        
+        // Adaptive threshold based on signal energy
+        float adaptive_threshold = tuning_.onset_threshold * (1.0f + result.rms);
+        onset_->set_threshold(std::min(adaptive_threshold, 2.0f * tuning_.onset_threshold));
+        
+        // Stages shed under overload; bars and bands decay as if silent
+        const bool want_pitch = pitch_worker_ && degrade_ < Degrade::NoPitch;
+        const bool want_bars = bars_ && degrade_ < Degrade::NoBars;
+        const bool want_bands = bands_ && degrade_ < Degrade::OnsetOnly;
+        
+        // One window + FFT for every stage below; when decimating, detection
+        // gets its own small FFT and the full-rate one only feeds bars and pitch
+        fvec_t* detection_hop = &hop_view;
+        if (decimator_) {
+            decimator_->process(hop, buf_size_, decimated_.data());
+            stage_lap(Stage::Decimate);
+            decimated_frontend_->process(&decimated_view_);
+            if (want_pitch || want_bars || want_bands) frontend_->transform(&hop_view);
+            detection_hop = &decimated_view_;
+        } else {
+            frontend_->process(&hop_view);
+        }
+        if (want_bars) {
+            bars_->process(frontend_->spectrum());
+        } else if (bars_) {
+            bars_->decay();
+        }
+        if (bands_) {
+            if (want_bands) {
+                result.band_events = bands_->process(frontend_->spectrum());
+            } else {
+                bands_->decay();
+            }
+            std::copy_n(bands_->levels(), BandOnsets::COUNT, result.band_levels.begin());
+        }
+        stage_lap(Stage::Spectrum);
+        
+        // Onset-only keeps the last tempo and confidence for the beat gate
+        SpectralFrontEnd& detection = this->detection();
+        if (degrade_ < Degrade::OnsetOnly) tempo_->process(detection.tempo_odf());
+        float current_bpm = tempo_->bpm();
+        result.confidence = tempo_->confidence();
+        stage_lap(Stage::Tempo);
+        
+        // Use ONSET as primary beat source (more reliable)
+        result.is_onset = onset_->process(detection.onset_odf(), detection_hop);
+        stage_lap(Stage::Onset);
+        
+        // BPM smoothing with validity checking
+        if (current_bpm > BPM_MIN && current_bpm < BPM_MAX) {
+            smoothed_bpm_ = 0.7f * smoothed_bpm_ + 0.3f * current_bpm;
+        } else if (smoothed_bpm_ == 0.0f) {
+            smoothed_bpm_ = current_bpm;
+        }
+        result.bpm = smoothed_bpm_;
+        
+        // Trust beat only if both onset detected AND tempo confident
+        result.is_beat = result.is_onset && result.confidence > tuning_.confidence;
+        
+        // Beat detection
+        if (result.is_beat) {
+            total_beats_++;
+            
+            history_.push(smoothed_bpm_);
+            
+            // Track BPM stability
+            stability_.push(smoothed_bpm_);
+        }
+        
+        // Every beat gets a pitch estimate, other hops only at --pitch-rate
+        if (want_pitch && (result.is_beat || (pitch_interval_ && result.sample_index >= next_pitch_sample_))) {
+            pitch_worker_->request(frontend_->spectrum(), result.sample_index);
+            if (pitch_interval_) next_pitch_sample_ = result.sample_index + pitch_interval_;
+            stage_lap(Stage::Pitch);
+        }
+        
+        update_phase(result);
+        fill_statistics(result);
+        if (recorder_) result.flight_dump = recorder_->record_hop(result);
+        listener_->on_hop(result);
+        total_onsets_++;
+        stage_lap(Stage::Output);
+        hop_done();
+    }
+    
+    const uint32_t buf_size_;
+    const uint32_t fft_size_;
+    const uint32_t sample_rate_;
+    const OnsetEngine engine_;
+    const uint32_t decimation_;
+    const bool enable_pitch_detection_;
+    const bool enable_performance_stats_;
+    const uint32_t bar_count_;
+    const bool enable_bands_;
+    HopListener* const listener_;
+    
+    // Analysis pipeline: one spectrum per hop feeds every stage
+    std::unique_ptr<SpectralFrontEnd> frontend_;
+    std::unique_ptr<TempoTracker> tempo_;
+    std::unique_ptr<OnsetPicker> onset_;
+    std::unique_ptr<PitchWorker> pitch_worker_;
+    std::unique_ptr<SpectrumBars> bars_;
+    std::unique_ptr<BandOnsets> bands_;
+    
+    std::unique_ptr<FlightRecorder> recorder_;
+    
+    // Decimated tempo path (--decimate), unused at full rate
+    std::unique_ptr<Decimator> decimator_;
+    std::unique_ptr<SpectralFrontEnd> decimated_frontend_;
+    std::vector<float> decimated_;
+    fvec_t decimated_view_{};
+    
+    // Holds a partial hop when the input block is not a multiple of buf_size_
+    const GateKernels& gate_kernels_;
+    std::vector<float> sample_accumulator_;
+    uint32_t accumulated_samples_;
+    GateStats accumulated_gate_;
+    uint64_t samples_seen_;
+    
+    // Beat analysis
+    uint64_t frame_count_;
+    uint64_t total_beats_;
+    uint64_t total_onsets_;
+    BpmStatistics<BPM_HISTORY_SIZE> history_;
+    BpmStatistics<STABILITY_WINDOW> stability_;
+    BeatPhaseTracker phase_;
+    float smoothed_bpm_;
+    
+    // Pitch requests (--pitch)
+    float pitch_rate_hz_ = 10.0f;
+    uint64_t pitch_interval_ = 0;   // samples between rate-driven requests, 0 = beats only
+    uint64_t next_pitch_sample_ = 0;
+    float latest_pitch_ = 0.0f;
+    
+    Degrade degrade_ = Degrade::Full;
+    Tuning tuning_;
+    
+    // Capture timing, from the timestamps passed to feed_samples()
+    const double ns_per_sample_;
+    uint64_t hop_time_ns_;
+    
+    // Performance tracking: whole-run latency histograms per stage
+    std::array<LatencyHistogram, static_cast<size_t>(Stage::Count)> latency_;
+    uint64_t stage_mark_ns_;
+    uint64_t hop_start_ns_;
+};
+
+// Something for the console renderer to show, queued by the analysing
+// thread instead of printing there
+struct ConsoleEvent {
+    enum class Kind : uint8_t { Debug, Silence, Beat };
+    Kind kind = Kind::Debug;
+    bool is_beat = false;
+    bool is_stable = false;
+    uint64_t frame = 0;
+    float amplitude = 0.0f;
+    float bpm = 0.0f;
+    float confidence = 0.0f;
+    float average_bpm = 0.0f;
+};
+
+// One --bars-stdout line, already scaled to 0..100, queued for the renderer
+// like the console events
+struct BarsLine {
+    uint32_t count = 0;
+    std::array<uint8_t, SpectrumBars::MAX_BARS> values{};
+};
+
+// What one of our own threads asks of the scheduler (--rt-priority,
+// --worker-cpus, --renderer-cpus). Each thread applies it to itself when it
+// starts: rtkit, reached through PipeWire's module-rt, only reliably
+// promotes the calling thread.
+struct ThreadPolicy {
+    std::string name;               // shown by top -H, perf and gdb; cut to 15 characters
+    int rt_priority = 0;            // SCHED_FIFO priority, 0 = stay SCHED_OTHER
+    std::vector<int> cpus;          // allowed CPUs, empty = any
+};
+
+// Applies `policy` to the calling thread and returns what actually took effect
+inline std::string apply_thread_policy(const ThreadPolicy& policy) {
+    const pthread_t self = pthread_self();
+    pthread_setname_np(self, policy.name.substr(0, 15).c_str());
+    std::ostringstream report;
+    report << policy.name << ": ";
+    
+    if (policy.rt_priority > 0) {
+        // SCHED_FIFO directly when we may (CAP_SYS_NICE or RLIMIT_RTPRIO), else ask rtkit
+        sched_param param{};
+        param.sched_priority = policy.rt_priority;
+        int direct = pthread_setschedparam(self, SCHED_FIFO, &param);
+        int rtkit = direct == 0 ? 0 : pw_thread_utils_acquire_rt(reinterpret_cast<spa_thread*>(self), policy.rt_priority);
+        
+        int current = SCHED_OTHER;
+        sched_param now{};
+        pthread_getschedparam(self, &current, &now);
+        if (current == SCHED_FIFO || current == SCHED_RR) {
+            report << (current == SCHED_FIFO ? "SCHED_FIFO " : "SCHED_RR ") << now.sched_priority
+                   << (direct == 0 ? "" : " (rtkit)");
+        } else {
+            report << "SCHED_OTHER (SCHED_FIFO: " << std::strerror(direct) << ", rtkit: "
+                   << (rtkit < 0 ? std::strerror(-rtkit) : "no effect") << ")";
+        }
+    } else {
+        report << "SCHED_OTHER";
+    }
+    
+    if (!policy.cpus.empty()) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int cpu : policy.cpus) CPU_SET(cpu, &set);
+        int err = pthread_setaffinity_np(self, sizeof(set), &set);
+        if (err == 0) {
+            report << ", CPU";
+            for (size_t i = 0; i < policy.cpus.size(); ++i) report << (i ? "," : " ") << policy.cpus[i];
+        } else {
+            report << ", affinity not set (" << std::strerror(err) << ")";
+        }
+    }
+    return report.str();
+}
+
+// What the previous run learned about the graph, so the next one can build
+// its analysers before PipeWire has negotiated anything: the rate each
+// --target came up at, keyed by target. Lines of "<rate> <target>" in
+// $XDG_CACHE_HOME/beat_detector/startup; a missing or unreadable file just
+// means the first negotiation rebuilds the analyser, as before.
+class StartupCache {
+public:
+    static StartupCache load() {
+        StartupCache cache;
+        std::ifstream in(cache.path_);
+        uint32_t rate;
+        std::string target;
+        while (in >> rate && std::getline(in >> std::ws, target)) {
+            if (rate > 0) cache.rates_.emplace_back(target, rate);
+        }
+        return cache;
+    }
+    
+    uint32_t rate(const std::string& target, uint32_t fallback) const {
+        for (const auto& [name, rate] : rates_) {
+            if (name == target) return rate;
+        }
+        return fallback;
+    }
+    
+    // Main loop, on negotiation; written only when something changed
+    void remember(const std::string& target, uint32_t rate) {
+        if (this->rate(target, 0) == rate) return;
+        auto entry = std::find_if(rates_.begin(), rates_.end(), [&](const auto& e) { return e.first == target; });
+        if (entry != rates_.end()) {
+            entry->second = rate;
+        } else {
+            rates_.emplace_back(target, rate);
+        }
+        save();
+    }
+
+private:
+    StartupCache() {
+        const char* cache_dir = std::getenv("XDG_CACHE_HOME");
+        const char* home = std::getenv("HOME");
+        std::string dir = cache_dir && *cache_dir ? cache_dir : std::string(home ? home : "/tmp") + "/.cache";
+        dir_ = dir + "/beat_detector";
+        path_ = dir_ + "/startup";
+    }
+    
+    void save() const {
+        mkdir(dir_.substr(0, dir_.rfind('/')).c_str(), 0755);     // ~/.cache may not exist yet
+        mkdir(dir_.c_str(), 0755);
+        std::string tmp = path_ + ".tmp";
+        std::ofstream out(tmp, std::ios::trunc);
+        for (const auto& [target, rate] : rates_) out << rate << ' ' << target << '\n';
+        out.close();
+        if (out) std::rename(tmp.c_str(), path_.c_str());
+    }
+    
+    std::string dir_;
+    std::string path_;
+    std::vector<std::pair<std::string, uint32_t>> rates_;
+};
+
+// A ring position and the CLOCK_MONOTONIC capture time of that sample
+struct TimeAnchor {
+    uint64_t frame = 0;
+    uint64_t capture_ns = 0;
+};
 
 class EnhancedBeatDetector {
 private:
-    static constexpr uint32_t SAMPLE_RATE = 44100;
-    static constexpr uint32_t CHANNELS = 1;
-    static constexpr float SILENCE_THRESHOLD = 0.01f;  // -40dB
-    static constexpr float BPM_MIN = 60.0f;
-    static constexpr float BPM_MAX = 200.0f;
-    static constexpr float CONFIDENCE_THRESHOLD = 0.5f;
-    static constexpr float BPM_VARIANCE_LIMIT = 5.0f;
+    static constexpr uint32_t SAMPLE_RATE = 44100;       // assumed until the graph format is known
+    static constexpr auto CONSOLE_FRAME = std::chrono::microseconds(1000000 / 30);
+    static constexpr size_t CONSOLE_QUEUE = 64;
+    static constexpr size_t BARS_QUEUE = 8;
+    static constexpr size_t RING_CAPACITY = 1 << 16;     // ~1.5s of audio at 44.1kHz
+    static constexpr uint32_t DOWNMIX_FRAMES = 2048;     // frames downmixed per chunk
+    static constexpr uint32_t IDLE_LATENCY_FRAMES = 8192; // requested quantum while idle
+    static constexpr size_t STEAL_SLICE = 2048;          // samples analysed per claim of a source
+    static constexpr double PITCH_WAIT_S = 0.1;          // longest a beat record waits for its pitch
+    
+    // Audio-thread notices applied on the main loop (node properties, prints)
+    static constexpr uint32_t NOTIFY_IDLE = 1u << 0;
+    static constexpr uint32_t NOTIFY_QUANTUM = 1u << 1;
+    static constexpr uint32_t NOTIFY_SUBSCRIBERS = 1u << 2;
+    static constexpr uint32_t NOTIFY_FLIGHT_DUMP = 1u << 3;
+    static constexpr uint32_t NOTIFY_DEGRADE = 1u << 4;
+    static constexpr uint32_t NOTIFY_FIRST_BEAT = 1u << 5;
+    
+    // Time to first beat: CLOCK_MONOTONIC milestones of one source, counted
+    // from startup or from the last time capture was switched back on; 0
+    // until reached. The analysing thread sets the last three.
+    struct Warmup {
+        uint64_t start_ns = 0;
+        std::atomic<uint64_t> analyzer_ns{0};   // analyser built and installed
+        std::atomic<uint64_t> streaming_ns{0};
+        std::atomic<uint64_t> first_hop_ns{0};  // audio is flowing
+        std::atomic<uint64_t> first_sound_ns{0};
+        std::atomic<uint64_t> first_beat_ns{0};
+        
+        void restart(uint64_t now) {
+            start_ns = now;
+            streaming_ns.store(0, std::memory_order_relaxed);
+            first_hop_ns.store(0, std::memory_order_relaxed);
+            first_sound_ns.store(0, std::memory_order_relaxed);
+            first_beat_ns.store(0, std::memory_order_relaxed);
+        }
+    };
+    
+    // What the analysers are built from: the command line, then SET
+    // commands. Main loop only; analysing threads see it through the
+    // analyser and tuning they were handed.
+    struct AnalysisConfig {
+        uint32_t hop;
+        OnsetEngine engine;
+        uint32_t decimation;
+        bool pitch;
+        float pitch_rate_hz;
+        uint32_t bar_count;
+        bool bands;
+        BeatAnalyzer::Tuning tuning;
+    };
+    
+    // One capture target with its own stream, analysis pipeline and output
+    // state. Only one thread works on a source at a time: its RT callback,
+    // or whichever pool worker holds `busy`.
+    struct Source : public HopListener {
+        Source(EnhancedBeatDetector* owner, size_t position, std::string node_target)
+            : detector(owner)
+            , index(position)
+            , target(std::move(node_target))
+            , tuning(std::make_unique<BeatAnalyzer::Tuning>(owner->config_.tuning))
+            , downmix_buffer(DOWNMIX_FRAMES)
+            , governor(static_cast<uint64_t>(owner->options_.degrade_step_ms * 1e6f), owner->options_.degrade_limit)
+        {}
+        
+        void on_hop(const HopResult& hop) override { detector->on_hop(*this, hop); }
+        
+        EnhancedBeatDetector* const detector;
+        const size_t index;             // --target order; also the logger producer
+        const std::string target;       // "sink", "mic" or a target.object value
+        std::atomic<uint32_t> node_id{SPA_ID_INVALID};
+        pw_stream* stream = nullptr;
+        
+        // Built alongside the PipeWire connection at startup, so empty until
+        // then; rebuilt on the main loop when the negotiated rate or the
+        // settings change. Thresholds alone travel separately.
+        SwapSlot<BeatAnalyzer> analyzer;
+        SwapSlot<BeatAnalyzer::Tuning> tuning;
+        uint32_t analyzer_rate = SAMPLE_RATE;
+        
+        // Negotiated channel layout, downmixed to mono before analysis
+        std::atomic<uint32_t> channels{1};
+        std::atomic<uint32_t> rate{SAMPLE_RATE};
+        std::vector<float> downmix_buffer;
+        
+        // Pool analysis: the RT callback only copies into the ring
+        std::unique_ptr<SpscRing<float>> sample_ring;
+        std::atomic<bool> busy{false};
+        std::atomic<uint64_t> dropped_samples{0};
+        
+        // Capture timing for pooled analysis: the RT callback posts the ring
+        // position and capture time of each block, the analysing worker maps
+        // its read position through the latest one
+        std::unique_ptr<SpscRing<TimeAnchor>> anchors;
+        uint64_t frames_written = 0;    // RT thread
+        uint64_t frames_read = 0;       // whichever worker holds `busy`
+        TimeAnchor anchor;
+        
+        // Per-source outputs; the daemon and bars lines share the detector's
+        std::unique_ptr<ShmPublisher> shm;
+        std::unique_ptr<SpscRing<SubscriberUpdate>> updates;
+        uint64_t last_update_ns = 0;
+        uint32_t pending_update_beats = 0;
+        std::array<uint32_t, BandOnsets::COUNT> pending_update_bands{};
+        uint64_t last_bars_stdout_ns = 0;
+        
+        std::atomic<uint32_t> notify_flags{0};
+        
+        // Console lines waiting for the renderer; when it falls behind
+        // (a slow terminal), lines are dropped rather than analysis delayed
+        std::unique_ptr<SpscRing<ConsoleEvent>> console;
+        std::unique_ptr<SpscRing<BarsLine>> bars_lines;  // --bars-stdout, first source only
+        std::atomic<uint64_t> console_dropped{0};
+        std::atomic<uint64_t> bars_dropped{0};          // --bars-stdout lines, the reader stalled
+        
+        // With --pitch a beat's log record waits for its pitch estimate
+        BeatRecord pending_record{};
+        uint64_t pending_record_sample = 0;
+        bool record_pending = false;
+        
+        // Idle mode: after a stretch of silence the stream asks for a much larger
+        // quantum so the graph wakes us rarely; the first loud hop switches back.
+        // The analysing thread decides, the main loop applies it to the node.
+        uint64_t silent_hops = 0;
+        bool idle = false;
+        std::atomic<bool> want_idle{false};
+        bool idle_applied = false;
+        
+        // Frames per process callback, as last seen by the audio thread
+        std::atomic<uint32_t> quantum_frames{0};
+        
+        LatencyHistogram callback_latency;
+        
+        // Overload accounting. Late callbacks are judged from the graph clock:
+        // a cycle that arrives more than one and a half quanta after the
+        // previous one means the graph skipped us for the quanta in between.
+        std::atomic<uint64_t> null_buffers{0};      // process callbacks with nothing to dequeue
+        std::atomic<uint64_t> late_callbacks{0};
+        std::atomic<uint64_t> missed_quanta{0};
+        std::atomic<uint64_t> ring_overruns{0};     // callbacks that found the pool ring full
+        std::atomic<uint64_t> overlong_callbacks{0};  // in-callback analysis slower than the quantum
+        std::atomic<bool> cycle_reset{true};        // (re)started streaming: no previous cycle to compare
+        uint64_t last_cycle_ns = 0;                 // RT thread
+        uint64_t last_period_ns = 0;
+        uint64_t callback_backlog_ns = 0;           // RT thread, unpooled: analysis time owed to the graph
+        
+        Warmup warmup;
+        
+        // Sheds analysis stages while the backlog grows (--degrade)
+        OverloadGovernor governor;
+        Degrade reported_degrade_rt = Degrade::Full;  // analysing thread, last level notified
+        Degrade reported_degrade = Degrade::Full;   // main loop, last level printed
+    };
     
     // PipeWire objects
     pw_main_loop* main_loop_;
     pw_context* context_;
     pw_core* core_;
-    pw_stream* stream_;
-    
-    // Aubio objects
-    std::unique_ptr<aubio_tempo_t, decltype(&del_aubio_tempo)> tempo_;
-    std::unique_ptr<fvec_t, decltype(&del_fvec)> input_buffer_;
-    std::unique_ptr<fvec_t, decltype(&del_fvec)> output_buffer_;
     
-    // Additional aubio objects for enhanced features
-    std::unique_ptr<aubio_onset_t, decltype(&del_aubio_onset)> onset_;
-    std::unique_ptr<aubio_pitch_t, decltype(&del_aubio_pitch)> pitch_;
-    std::unique_ptr<fvec_t, decltype(&del_fvec)> pitch_buffer_;
+    const DetectorOptions options_;
+    AnalysisConfig config_;
+    const DownmixKernel& downmix_;
     
-    const uint32_t buf_size_;
-    const uint32_t fft_size_;
+    // One entry per --target, the default sink when none were given
+    std::vector<std::unique_ptr<Source>> sources_;
     
     static std::atomic<bool> should_quit_;
     static EnhancedBeatDetector* instance_;
     
     // Enhanced features
-    std::ofstream log_file_;
-    bool enable_logging_;
-    bool enable_performance_stats_;
-    bool enable_pitch_detection_;
-    bool enable_visual_feedback_;
-    
-    // Performance tracking
-    std::vector<double> process_times_;
-    uint64_t total_beats_;
-    uint64_t total_onsets_;
-    std::chrono::steady_clock::time_point start_time_;
+    std::unique_ptr<BeatLogger> logger_;
     
-    // Beat analysis
-    std::vector<float> recent_bpms_;
-    std::vector<float> bpm_stability_;
-    static constexpr size_t BPM_HISTORY_SIZE = 20;
-    static constexpr size_t STABILITY_WINDOW = 5;
-    float smoothed_bpm_;
-    std::chrono::steady_clock::time_point last_beat_time_;
+    // Analysis pool (--worker, --pool, or several targets). Every RT callback
+    // posts one semaphore; a woken worker drains its own sources first and
+    // then steals from the others', a slice at a time, so one loud source
+    // cannot hold a worker while another's ring fills up.
+    const bool pooled_;
+    size_t pool_size_;
+    std::vector<std::thread> workers_;
     
-    // Circular buffer for variable PipeWire buffer sizes
-    std::vector<float> sample_accumulator_;
-    uint32_t accumulated_samples_;
+    // Console renderer: all human-readable per-hop output, at a fixed rate
+    std::thread renderer_;
+    sem_t work_sem_;
     
-    // Performance tracking
-    uint64_t frame_count_;
+    // Daemon mode: updates cross from the analysis threads to the main loop,
+    // which formats and sends them; capture runs only while someone listens
+    std::unique_ptr<SubscriberServer> server_;
+    std::atomic<bool> has_subscribers_;
+    uint64_t update_interval_ns_;
+    
+    // Cava-style bar lines on stdout (--bars-stdout), first source only
+    uint64_t bars_stdout_interval_ns_;
+    
+    // Wakes the main loop for the sources' notify_flags
+    spa_source* notify_event_;
+    
+    // Runtime statistics; each analyser keeps its per-hop stages
+    spa_source* stats_signal_;
+    spa_source* stats_timer_;
+    spa_source* record_signal_;     // SIGUSR2 dumps the flight recorders
+    spa_source* stdin_source_;      // control commands on stdin
+    std::string stdin_buffer_;
+    std::chrono::steady_clock::time_point start_time_;
+    std::string memory_lock_;       // outcome of lock_memory(), for the startup banner
+    std::vector<std::string> thread_reports_;  // what each start_thread() policy achieved
+    bool ok_ = false;               // initialize() succeeded; sources may lack an analyser otherwise
+    StartupCache startup_cache_;
+    uint64_t startup_ns_ = 0;
+    double pipewire_ms_ = 0.0;      // pw_init to connected core, for the banner
+    double analyzers_ms_ = 0.0;     // building every analyser, on the helper thread
     
     // Visual feedback
-    std::string generate_beat_visual(float bpm, float confidence, bool is_beat) {
-        if (!enable_visual_feedback_) return "";
-        
-        std::stringstream ss;
-        if (is_beat) {
-            int intensity = static_cast<int>(std::min(bpm / 20.0f, 10.0f));
-            ss << "\r 🎵 ";
-            for (int i = 0; i < intensity; ++i) ss << "█";
-            for (int i = intensity; i < 10; ++i) ss << "░";
-            ss << " BPM: " << std::fixed << std::setprecision(1) << bpm;
-            ss << " | Conf: " << std::setprecision(2) << confidence;
-            ss << " | Avg: " << get_average_bpm();
+    void generate_beat_visual(TextLine& line, const Source& src, const ConsoleEvent& beat) const {
+        int intensity = static_cast<int>(std::min(beat.bpm / 20.0f, 10.0f));
+        line << "\r 🎵 ";
+        append_label(line, src);
+        for (int i = 0; i < intensity; ++i) line << "█";
+        for (int i = intensity; i < 10; ++i) line << "░";
+        line << " BPM: ";
+        line.fixed(beat.bpm, 1) << " | Conf: ";
+        line.fixed(beat.confidence, 2) << " | Avg: ";
+        line.fixed(beat.average_bpm, 2);
+    }
+    
+    void format_event(TextLine& line, const Source& src, const ConsoleEvent& event) const {
+        switch (event.kind) {
+            case ConsoleEvent::Kind::Silence:
+                line << " ";
+                append_label(line, src);
+                line << "[SILENCE] Frame #" << event.frame << " (amp: ";
+                line.fixed(event.amplitude, 4) << ")\n";
+                break;
+            case ConsoleEvent::Kind::Debug:
+                line << " ";
+                append_label(line, src);
+                line << "[DEBUG] Frame #" << event.frame << " | Amp: ";
+                line.fixed(event.amplitude, 4) << " | BPM: ";
+                line.fixed(event.bpm, 1) << " | Conf: ";
+                line.fixed(event.confidence, 2) << " | Beat: " << (event.is_beat ? "YES" : "NO") << "\n";
+                break;
+            case ConsoleEvent::Kind::Beat:
+                if (options_.enable_visual_feedback) {
+                    generate_beat_visual(line, src, event);
+                    break;
+                }
+                line << " 🎵 ";
+                append_label(line, src);
+                line << "BEAT! BPM: ";
+                line.fixed(event.bpm, 1) << " | Conf: ";
+                line.fixed(event.confidence, 2);
+                if (event.is_stable) {
+                    line << " | STABLE";
+                }
+                line << "\n";
+                break;
+        }
+    }
+    
+    // One frame per CONSOLE_FRAME: drain every source's queued lines into a
+    // fixed buffer and emit them with a single write. A visual beat line
+    // overwrites itself, so only the newest one per frame is drawn.
+    void render_loop() {
+        TextLine frame;
+        auto next = std::chrono::steady_clock::now();
+        for (bool last = false; !last; ) {
+            last = should_quit_;
+            for (auto& src : sources_) {
+                ConsoleEvent event;
+                ConsoleEvent visual;
+                bool have_visual = false;
+                while (src->console->read(&event, 1) == 1) {
+                    if (event.kind == ConsoleEvent::Kind::Beat && options_.enable_visual_feedback) {
+                        visual = event;
+                        have_visual = true;
+                        continue;
+                    }
+                    if (frame.size() > TextLine::CAPACITY / 2) {
+                        frame.write_to(STDOUT_FILENO);
+                        frame.clear();
+                    }
+                    format_event(frame, *src, event);
+                }
+                if (have_visual) format_event(frame, *src, visual);
+                
+                // Same format as cava's raw ascii output (0..100, ';'-terminated), with a prefix
+                BarsLine bars;
+                while (src->bars_lines && src->bars_lines->read(&bars, 1) == 1) {
+                    if (frame.size() + 7 + 4 * bars.count > TextLine::CAPACITY) {
+                        frame.write_to(STDOUT_FILENO);
+                        frame.clear();
+                    }
+                    frame << "BARS: ";
+                    for (uint32_t i = 0; i < bars.count; ++i) frame << bars.values[i] << ';';
+                    frame << '\n';
+                }
+            }
+            if (frame.size() > 0) {
+                frame.write_to(STDOUT_FILENO);
+                frame.clear();
+            }
+            
+            next += CONSOLE_FRAME;
+            std::this_thread::sleep_until(next);
+        }
+    }
+    
+    // Starts `body` on a thread that first applies `policy` to itself, and
+    // waits for that so the startup banner can report what took effect
+    template <typename Body>
+    std::thread start_thread(ThreadPolicy policy, Body body) {
+        std::promise<std::string> applied;
+        std::future<std::string> report = applied.get_future();
+        std::thread thread([policy = std::move(policy), applied = std::move(applied), body = std::move(body)]() mutable {
+            applied.set_value(apply_thread_policy(policy));
+            body();
+        });
+        thread_reports_.push_back(report.get());
+        return thread;
+    }
+    
+    void stop_renderer() {
+        if (!renderer_.joinable()) return;
+        should_quit_ = true;
+        renderer_.join();
+    }
+    
+    // Analysing thread: hand a line to the renderer
+    void console_event(Source& src, const ConsoleEvent& event) {
+        if (src.console->write(&event, 1) == 0) {
+            src.console_dropped.fetch_add(1, std::memory_order_relaxed);
         }
-        return ss.str();
     }
 
 public:
-    explicit EnhancedBeatDetector(uint32_t buf_size = 128, 
-                                 bool enable_logging = true,
-                                 bool enable_performance_stats = true,
-                                 bool enable_pitch_detection = false,
-                                 bool enable_visual_feedback = true) 
+    explicit EnhancedBeatDetector(const DetectorOptions& options)
         : main_loop_(nullptr)
         , context_(nullptr)
         , core_(nullptr)
-        , stream_(nullptr)
-        , tempo_(nullptr, &del_aubio_tempo)
-        , input_buffer_(nullptr, &del_fvec)
-        , output_buffer_(nullptr, &del_fvec)
-        , onset_(nullptr, &del_aubio_onset)
-        , pitch_(nullptr, &del_aubio_pitch)
-        , pitch_buffer_(nullptr, &del_fvec)
-        , buf_size_(buf_size)
-        , fft_size_(buf_size * 8)
-        , enable_logging_(enable_logging)
-        , enable_performance_stats_(enable_performance_stats)
-        , enable_pitch_detection_(enable_pitch_detection)
-        , enable_visual_feedback_(enable_visual_feedback)
-        , total_beats_(0)
-        , total_onsets_(0)
-        , smoothed_bpm_(0.0f)
-        , accumulated_samples_(0)
-        , frame_count_(0)
+        , options_(options)
+        , config_{options.buffer_size, options.engine, options.decimation, options.enable_pitch_detection,
+                  options.pitch_rate_hz, options.bar_count, options.enable_bands, {}}
+        , downmix_(downmix_kernels::select())
+        , pooled_(options.enable_worker || options.pool_threads > 0 || options.targets.size() > 1)
+        , pool_size_(0)
+        , has_subscribers_(false)
+        , update_interval_ns_(options.daemon_rate_hz > 0.0f ? static_cast<uint64_t>(1e9f / options.daemon_rate_hz) : 0)
+        , bars_stdout_interval_ns_(options.bars_fps > 0.0f ? static_cast<uint64_t>(1e9f / options.bars_fps) : 0)
+        , notify_event_(nullptr)
+        , stats_signal_(nullptr)
+        , stats_timer_(nullptr)
+        , record_signal_(nullptr)
+        , stdin_source_(nullptr)
+        , startup_cache_(StartupCache::load())
     {
         instance_ = this;
-        recent_bpms_.reserve(BPM_HISTORY_SIZE);
-        bpm_stability_.reserve(STABILITY_WINDOW);
-        sample_accumulator_.resize(buf_size_);
-        if (enable_performance_stats_) {
-            process_times_.reserve(1000);
-        }
-        initialize();
+        ok_ = initialize();
     }
     
     ~EnhancedBeatDetector() {
+        stop_renderer();
         print_final_stats();
         cleanup();
         instance_ = nullptr;
@@ -143,22 +3995,60 @@ public:
     
     bool initialize() {
         start_time_ = std::chrono::steady_clock::now();
+        startup_ns_ = clock_ns(CLOCK_MONOTONIC);
+        
+        std::vector<std::string> targets = options_.targets;
+        if (targets.empty()) targets.push_back("sink");
+        for (size_t i = 0; i < targets.size(); ++i) {
+            sources_.push_back(std::make_unique<Source>(this, i, targets[i]));
+            sources_.back()->analyzer_rate = startup_cache_.rate(targets[i], SAMPLE_RATE);
+            sources_.back()->warmup.restart(startup_ns_);
+        }
+        
+        // Building the analysers (aubio objects, FFTs, tables) overlaps with
+        // bringing up PipeWire and connecting the streams; at the rate the
+        // cache remembers, negotiation usually leaves them as they are
+        auto built = std::async(std::launch::async, [this] {
+            uint64_t start = clock_ns(CLOCK_MONOTONIC);
+            std::vector<std::unique_ptr<BeatAnalyzer>> analyzers;
+            for (auto& src : sources_) {
+                analyzers.push_back(make_analyzer(config_, src->analyzer_rate, src.get()));
+                if (!analyzers.back()->initialize()) analyzers.back().reset();
+            }
+            analyzers_ms_ = (clock_ns(CLOCK_MONOTONIC) - start) / 1e6;
+            return analyzers;
+        });
         
         // Initialize logging
-        if (enable_logging_) {
+        if (options_.enable_logging) {
             auto now = std::chrono::system_clock::now();
             auto time_t = std::chrono::system_clock::to_time_t(now);
             std::stringstream filename;
-            filename << "beat_log_" << std::put_time(std::localtime(&time_t), "%Y%m%d_%H%M%S") << ".txt";
-            log_file_.open(filename.str());
-            if (log_file_.is_open()) {
-                log_file_ << "# Beat Detection Log - " << std::put_time(std::localtime(&time_t), "%Y-%m-%d %H:%M:%S") << "\n";
-                log_file_ << "# Timestamp,BPM,Confidence,Pitch(Hz),Amplitude,Variance\n";
+            filename << "beat_log_" << std::put_time(std::localtime(&time_t), "%Y%m%d_%H%M%S")
+                     << (options_.log_format == BeatLogger::Format::Binary ? ".bdl" : ".txt");
+            logger_ = BeatLogger::create(filename.str(), options_.log_format, sources_.size());
+            if (logger_) {
                 std::cout << " Logging to: " << filename.str() << std::endl;
             }
         }
         
+        // Initialize shared-memory output: <name> for the first source, <name>-<n> for the rest
+        if (!options_.shm_name.empty()) {
+            for (auto& src : sources_) {
+                std::string name = src->index == 0 ? options_.shm_name : options_.shm_name + "-" + std::to_string(src->index);
+                src->shm = ShmPublisher::create(name, options_.shm_rate_hz, options_.shm_eventfd);
+                if (!src->shm) {
+                    std::cerr << " Failed to create shared memory segment " << name << ": "
+                              << (errno == EEXIST ? "another detector is already publishing there" : std::strerror(errno))
+                              << std::endl;
+                    return false;
+                }
+                std::cout << " Publishing " << src->target << " to: /dev/shm" << src->shm->path() << std::endl;
+            }
+        }
+        
         // Initialize PipeWire
+        const uint64_t pipewire_start = clock_ns(CLOCK_MONOTONIC);
         pw_init(nullptr, nullptr);
         
         main_loop_ = pw_main_loop_new(nullptr);
@@ -178,62 +4068,156 @@ public:
             std::cerr << " Failed to connect to PipeWire" << std::endl;
             return false;
         }
+        pipewire_ms_ = (clock_ns(CLOCK_MONOTONIC) - pipewire_start) / 1e6;
         
-        // Initialize Aubio tempo detector with HFC method (better accuracy)
-        tempo_.reset(new_aubio_tempo("hfc", fft_size_, buf_size_, SAMPLE_RATE));
-        if (!tempo_) {
-            std::cerr << " Failed to create aubio tempo detector" << std::endl;
-            return false;
+        notify_event_ = pw_loop_add_event(pw_main_loop_get_loop(main_loop_), on_notify_event, this);
+        
+        // Daemon mode listens before the streams exist; clients can only be
+        // served once the main loop runs
+        if (!options_.daemon_socket.empty()) {
+            server_ = SubscriberServer::create(options_.daemon_socket, pw_main_loop_get_loop(main_loop_),
+                                               [this](size_t count) { on_subscribers(count); },
+                                               [this](const std::string& line) { return control(line); },
+                                               [this](uint32_t node_id, bool primary) { return shm_eventfd(node_id, primary); });
+            if (!server_) {
+                std::cerr << " Cannot serve on " << options_.daemon_socket << ": "
+                          << (errno == EADDRINUSE ? "another detector is already running" : std::strerror(errno)) << std::endl;
+                return false;
+            }
+            for (auto& src : sources_) {
+                src->updates = std::make_unique<SpscRing<SubscriberUpdate>>(64);
+            }
+            std::cout << " Serving subscribers on: " << server_->path() << std::endl;
         }
-        aubio_tempo_set_threshold(tempo_.get(), 0.2f);       // More sensitive
-        aubio_tempo_set_delay_ms(tempo_.get(), 30.0);        // Faster response
-        aubio_tempo_set_silence(tempo_.get(), -45.0);        // Catch quieter signals
-        aubio_tempo_set_tatum_signature(tempo_.get(), 4);
         
-        input_buffer_.reset(new_fvec(buf_size_));
-        output_buffer_.reset(new_fvec(1));
+        // Start the analysis pool before the streams can deliver buffers
+        if (pooled_) {
+            for (auto& src : sources_) {
+                src->sample_ring = std::make_unique<SpscRing<float>>(RING_CAPACITY);
+                src->anchors = std::make_unique<SpscRing<TimeAnchor>>(64);
+            }
+            unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+            pool_size_ = options_.pool_threads > 0 ? options_.pool_threads : std::min<size_t>(sources_.size(), cores);
+            sem_init(&work_sem_, 0, 0);
+            for (size_t w = 0; w < pool_size_; ++w) {
+                ThreadPolicy policy{"bd-analysis-" + std::to_string(w), options_.rt_priority, options_.worker_cpus};
+                workers_.push_back(start_thread(policy, [this, w] { worker_loop(w); }));
+            }
+        }
         
-        if (!input_buffer_ || !output_buffer_) {
-            std::cerr << " Failed to create aubio buffers" << std::endl;
-            return false;
+        for (auto& src : sources_) {
+            src->console = std::make_unique<SpscRing<ConsoleEvent>>(CONSOLE_QUEUE);
+            if (options_.bars_stdout && src->index == 0) {
+                src->bars_lines = std::make_unique<SpscRing<BarsLine>>(BARS_QUEUE);
+            }
         }
+        renderer_ = start_thread({"bd-render", 0, options_.renderer_cpus}, [this] { render_loop(); });
         
-        // Initialize onset detection with HFC method
-        onset_.reset(new_aubio_onset("hfc", fft_size_, buf_size_, SAMPLE_RATE));
-        if (!onset_) {
-            std::cerr << " Failed to create aubio onset detector" << std::endl;
-            return false;
+        for (auto& src : sources_) {
+            if (!setup_stream(*src)) return false;
         }
-        aubio_onset_set_threshold(onset_.get(), 0.2f);       // Onset sensitivity
-        aubio_onset_set_minioi_ms(onset_.get(), 25.0);       // Min 25ms between beats
-        aubio_onset_set_silence(onset_.get(), -45.0);        // Only process above -45dB
         
-        // Initialize pitch detection if enabled
-        if (enable_pitch_detection_) {
-            pitch_.reset(new_aubio_pitch("default", fft_size_, buf_size_, SAMPLE_RATE));
-            pitch_buffer_.reset(new_fvec(1));
-            if (!pitch_ || !pitch_buffer_) {
-                std::cerr << " Failed to create aubio pitch detector" << std::endl;
-                return false;
+        // Buffers that arrive before this are skipped (or wait in the pool's ring)
+        std::vector<std::unique_ptr<BeatAnalyzer>> analyzers = built.get();
+        for (size_t i = 0; i < sources_.size(); ++i) {
+            if (!analyzers[i]) return false;
+            sources_[i]->analyzer.install(std::move(analyzers[i]));
+            sources_[i]->warmup.analyzer_ns.store(clock_ns(CLOCK_MONOTONIC), std::memory_order_relaxed);
+        }
+        return true;
+    }
+    
+    // False when initialize() failed; run() then returns straight away
+    bool ok() const { return ok_; }
+    
+    void run() {
+        if (!ok_) return;
+        
+        // Latency percentiles on demand (SIGUSR1) and/or periodically,
+        // printed from the main loop rather than from a signal handler
+        if (options_.enable_performance_stats) {
+            pw_loop* loop = pw_main_loop_get_loop(main_loop_);
+            stats_signal_ = pw_loop_add_signal(loop, SIGUSR1, on_stats_signal, this);
+            if (options_.stats_interval_s > 0.0f) {
+                stats_timer_ = pw_loop_add_timer(loop, on_stats_timer, this);
+                timespec interval;
+                interval.tv_sec = static_cast<time_t>(options_.stats_interval_s);
+                interval.tv_nsec = static_cast<long>((options_.stats_interval_s - interval.tv_sec) * 1e9f);
+                pw_loop_update_timer(loop, stats_timer_, &interval, &interval, false);
             }
-            aubio_pitch_set_unit(pitch_.get(), "Hz");
         }
-        
-        return setup_stream();
+        
+        if (options_.record_s > 0.0f) {
+            record_signal_ = pw_loop_add_signal(pw_main_loop_get_loop(main_loop_), SIGUSR2, on_record_signal, this);
+        }
+        
+        // SET/CONFIG on stdin; null when stdin cannot be polled (a regular file)
+        stdin_source_ = pw_loop_add_io(pw_main_loop_get_loop(main_loop_), STDIN_FILENO,
+                                       SPA_IO_IN | SPA_IO_ERR | SPA_IO_HUP, false, on_stdin, this);
+        
+        if (options_.lock_memory) lock_memory();
+        print_startup_info();
+        pw_main_loop_run(main_loop_);
+    }
+    
+    // Everything the RT path touches was allocated during setup; locking it
+    // keeps page faults out of the callback. Future mappings are only locked
+    // when the limit allows it, since MCL_FUTURE makes later allocations fail
+    // outright once RLIMIT_MEMLOCK is reached.
+    void lock_memory() {
+        rlimit limit{};
+        bool unlimited = getrlimit(RLIMIT_MEMLOCK, &limit) == 0 && limit.rlim_cur == RLIM_INFINITY;
+        if (mlockall(MCL_CURRENT | (unlimited ? MCL_FUTURE : 0)) == 0) {
+            memory_lock_ = unlimited ? "locked (current and future mappings)" : "locked (current mappings)";
+        } else {
+            memory_lock_ = std::string("not locked (") + std::strerror(errno) + ", raise RLIMIT_MEMLOCK)";
+        }
+    }
+    
+    void stop() {
+        should_quit_ = true;
+        if (main_loop_) {
+            pw_main_loop_quit(main_loop_);
+        }
+    }
+    
+    static void on_stats_signal(void* userdata, int) {
+        static_cast<EnhancedBeatDetector*>(userdata)->print_latency_reports();
+    }
+    
+    // SIGUSR2: every source's recorder freezes at its next hop and notifies
+    static void on_record_signal(void* userdata, int) {
+        for (auto& src : static_cast<EnhancedBeatDetector*>(userdata)->sources_) {
+            const BeatAnalyzer* analyzer = src->analyzer.get();
+            if (FlightRecorder* recorder = analyzer ? analyzer->recorder() : nullptr) recorder->request();
+        }
     }
     
-    void run() {
-        if (!main_loop_) return;
+    // Main loop: write a frozen flight recording next to the beat logs
+    void dump_flight(Source& src) {
+        const BeatAnalyzer* analyzer = src.analyzer.get();
+        FlightRecorder* recorder = analyzer ? analyzer->recorder() : nullptr;
+        if (!recorder) return;
         
-        print_startup_info();
-        pw_main_loop_run(main_loop_);
+        auto now = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+        std::stringstream filename;
+        filename << "beat_flight_" << std::put_time(std::localtime(&now), "%Y%m%d_%H%M%S");
+        if (sources_.size() > 1) filename << "-" << src.index;
+        filename << ".wav";
+        
+        const char* reason = recorder->last_reason() == FlightHeader::REASON_ANOMALY
+            ? "anomaly: no beats on loud audio" : "signal";
+        if (recorder->dump(filename.str())) {
+            std::cout << "󰻃 " << label(src) << "Flight recording (" << reason << ") → " << filename.str()
+                      << " (replay with --input)" << std::endl;
+        } else {
+            std::cerr << " " << label(src) << "Cannot write flight recording " << filename.str() << ": "
+                      << std::strerror(errno) << std::endl;
+        }
     }
     
-    void stop() {
-        should_quit_ = true;
-        if (main_loop_) {
-            pw_main_loop_quit(main_loop_);
-        }
+    static void on_stats_timer(void* userdata, uint64_t) {
+        static_cast<EnhancedBeatDetector*>(userdata)->print_latency_reports();
     }
     
     static void signal_handler(int sig) {
@@ -244,86 +4228,282 @@ public:
     }
 
 private:
+    std::unique_ptr<BeatAnalyzer> make_analyzer(const AnalysisConfig& config, uint32_t sample_rate, HopListener* listener) {
+        auto analyzer = std::make_unique<BeatAnalyzer>(config.hop, sample_rate, config.engine, config.decimation,
+                                                       config.pitch, config.bar_count, config.bands,
+                                                       options_.enable_performance_stats, listener);
+        analyzer->set_pitch_rate(config.pitch_rate_hz);
+        analyzer->set_tuning(config.tuning);
+        if (options_.record_s > 0.0f) {
+            analyzer->set_recorder(std::make_unique<FlightRecorder>(options_.record_s, sample_rate, config.hop,
+                                                                    config.decimation, config.engine));
+        }
+        return analyzer;
+    }
+    
+    // Analysing thread: the analyser for the next block. A rebuilt one takes
+    // over the outgoing one's state, and new thresholds are applied in place.
+    BeatAnalyzer* acquire_analyzer(Source& src) {
+        BeatAnalyzer* analyzer = src.analyzer.acquire([](BeatAnalyzer& next, const BeatAnalyzer& previous) {
+            next.carry_over(previous);
+        });
+        src.tuning.acquire([analyzer](const BeatAnalyzer::Tuning& next, const BeatAnalyzer::Tuning&) {
+            analyzer->set_tuning(next);
+        });
+        return analyzer;
+    }
+    
+    // Line prefix naming the source, once there is more than one
+    std::string label(const Source& src) const {
+        if (sources_.size() == 1) return "";
+        uint32_t id = src.node_id.load(std::memory_order_relaxed);
+        return "[" + src.target + (id != SPA_ID_INVALID ? " #" + std::to_string(id) : "") + "] ";
+    }
+    
+    // label() for the analysis path, without building a string
+    void append_label(TextLine& line, const Source& src) const {
+        if (sources_.size() == 1) return;
+        uint32_t id = src.node_id.load(std::memory_order_relaxed);
+        line << '[' << src.target;
+        if (id != SPA_ID_INVALID) line << " #" << id;
+        line << "] ";
+    }
+    
+    void print_latency_reports() {
+        for (const auto& src : sources_) {
+            const BeatAnalyzer* analyzer = src->analyzer.get();
+            if (!analyzer) continue;
+            if (sources_.size() > 1) std::cout << "   " << label(*src) << std::endl;
+            analyzer->print_latency_report(std::cout, &src->callback_latency);
+            print_overload_report(*src);
+        }
+    }
+    
+    // Drops, late quanta and backlog, with the time spent at each analysis level
+    void print_overload_report(const Source& src) const {
+        std::cout << "    Xruns: " << src.late_callbacks.load() << " late callback(s), " << src.missed_quanta.load()
+                  << " quanta missed, " << src.null_buffers.load() << " empty dequeue(s)" << std::endl;
+        if (pooled_) {
+            std::cout << "    Ring overruns: " << src.ring_overruns.load() << " (" << src.dropped_samples.load()
+                      << " samples dropped)" << std::endl;
+        } else {
+            std::cout << "    Callbacks over their quantum: " << src.overlong_callbacks.load() << std::endl;
+        }
+        
+        const OverloadGovernor& governor = src.governor;
+        std::cout << "    Analysis backlog: " << std::fixed << std::setprecision(1) << governor.backlog_ns() / 1e6
+                  << " ms (peak " << governor.peak_backlog_ns() / 1e6 << " ms)" << std::endl;
+        if (!governor.enabled() || governor.escalations() == 0) return;
+        std::cout << "    Degraded " << governor.escalations() << " time(s):";
+        for (size_t i = 1; i < DEGRADE_LEVELS; ++i) {
+            Degrade level = static_cast<Degrade>(i);
+            if (uint64_t ns = governor.level_ns(level)) {
+                std::cout << " " << degrade_name(level) << " " << std::setprecision(1) << ns / 1e9 << "s";
+            }
+        }
+        std::cout << std::endl;
+    }
+    
+    // Only after a successful initialize(), when every source has an analyser
     void print_startup_info() {
+        const BeatAnalyzer& analyzer = *sources_.front()->analyzer.get();
+        const SpectrumBars* bars = analyzer.bars();
+        
         std::cout << "\n󰝚  Beat Detector Started!" << std::endl;
-        std::cout << "   Buffer size: " << buf_size_ << " samples" << std::endl;
-        std::cout << "   FFT size: " << fft_size_ << " samples" << std::endl;
-        std::cout << "   Sample rate: " << SAMPLE_RATE << " Hz" << std::endl;
-        std::cout << "   Detection method: HFC (Harmonic Flux Coefficient)" << std::endl;
+        std::cout << "   Buffer size: " << analyzer.buf_size() << " samples" << std::endl;
+        std::cout << "   FFT size: " << analyzer.fft_size() << " samples" << std::endl;
+        std::cout << "   Sample rate: graph native (negotiated on connect)" << std::endl;
+        std::cout << "   Startup: PipeWire " << std::fixed << std::setprecision(1) << pipewire_ms_ << " ms, analysers "
+                  << analyzers_ms_ << " ms alongside it, prepared for " << sources_.front()->analyzer_rate << " Hz"
+                  << (startup_cache_.rate(sources_.front()->target, 0) ? " (last negotiated)" : " (guess)") << std::endl;
+        if (analyzer.engine() == OnsetEngine::Flux) {
+            std::cout << "   Detection method: log spectral flux, median threshold (" << analyzer.flux_kernel_name() << ")" << std::endl;
+        } else {
+            std::cout << "   Detection method: HFC (Harmonic Flux Coefficient)" << std::endl;
+        }
+        if (analyzer.decimation() > 1) {
+            std::cout << "   Tempo path: ÷" << analyzer.decimation() << " polyphase FIR (" << analyzer.fir_kernel_name()
+                      << "), FFT " << analyzer.fft_size() / analyzer.decimation() << std::endl;
+        } else {
+            std::cout << "   Spectral front-end: shared (1 FFT per hop)" << std::endl;
+        }
+        std::cout << "   Gate kernel: " << analyzer.gate_kernel_name() << std::endl;
+        std::cout << "   Hop kernels: " << (analyzer.fixed_hop() ? "fixed " + std::to_string(analyzer.buf_size()) + "-sample hop"
+                                                             : std::string("generic (no specialisation for this hop)")) << std::endl;
+        std::cout << "   Downmix kernel: " << downmix_.name << std::endl;
+        if (options_.record_s > 0.0f) {
+            std::cout << "   Flight recorder: last " << std::setprecision(0) << std::fixed << options_.record_s
+                      << " s (SIGUSR2, or beats lost on loud audio, dumps beat_flight_*.wav)" << std::endl;
+        }
+        std::cout << "   Memory: " << (options_.lock_memory ? memory_lock_ : "pageable (--no-mlock)") << std::endl;
+        std::cout << "   Threads:" << std::endl;
+        if (!pooled_) {
+            std::cout << "    analysis: in the PipeWire data thread, scheduled by the graph"
+                      << (options_.rt_priority > 0 || !options_.worker_cpus.empty() ? " (--worker to apply --rt-priority/--worker-cpus)" : "")
+                      << std::endl;
+        }
+        for (const std::string& report : thread_reports_) std::cout << "    " << report << std::endl;
+#ifdef BD_TRACK_ALLOCS
+        std::cout << "   Allocation tracking: on" << (alloc_tracking::abort_on_allocation ? " (abort)" : "") << std::endl;
+#endif
+        std::cout << "   Sources:";
+        for (const auto& src : sources_) {
+            std::cout << " " << src->target;
+        }
+        std::cout << std::endl;
         std::cout << "   Features enabled:" << std::endl;
-        std::cout << "    Logging: " << (enable_logging_ ? "✓" : "✗") << std::endl;
-        std::cout << "    Performance stats: " << (enable_performance_stats_ ? "✓" : "✗") << std::endl;
-        std::cout << "    Pitch detection: " << (enable_pitch_detection_ ? "✓" : "✗") << std::endl;
+        std::cout << "    Logging: " << (options_.enable_logging ? "✓" : "✗") << std::endl;
+        std::cout << "    Performance stats: " << (options_.enable_performance_stats ? "✓" : "✗") << std::endl;
+        std::cout << "    Pitch detection: ";
+        if (options_.enable_pitch_detection) {
+            std::cout << "✓ (worker thread, beats";
+            if (options_.pitch_rate_hz > 0.0f) std::cout << " + " << options_.pitch_rate_hz << " Hz";
+            std::cout << ")";
+        } else {
+            std::cout << "✗";
+        }
+        std::cout << std::endl;
+        std::cout << "    Analysis pool: ";
+        if (pooled_) {
+            std::cout << "✓ (" << pool_size_ << " worker(s), work stealing)";
+        } else {
+            std::cout << "✗ (RT callback)";
+        }
+        std::cout << std::endl;
+        std::cout << "    Spectrum bars: ";
+        if (bars) {
+            std::cout << "✓ (" << bars->count() << ")";
+        } else {
+            std::cout << "✗";
+        }
+        std::cout << std::endl;
+        std::cout << "    Band events: ";
+        if (const BandOnsets* bands = analyzer.bands()) {
+            std::cout << "✓ (" << std::setprecision(0) << std::fixed;
+            for (uint32_t b = 0; b < BandOnsets::COUNT; ++b) {
+                const BandOnsets::Band& band = BandOnsets::BANDS[b];
+                std::cout << (b ? ", " : "") << band.name << " " << band.low_hz << "-" << band.high_hz << " Hz"
+                          << (bands->covered(b) ? "" : " [above Nyquist]");
+            }
+            std::cout << ")";
+        } else {
+            std::cout << "✗";
+        }
+        std::cout << std::endl;
+        const ShmPublisher* shm = sources_.front()->shm.get();
+        std::cout << "    Shared-memory output: " << (shm ? "✓" : "✗");
+        if (shm) {
+            std::cout << " (" << options_.shm_rate_hz << " Hz max" << (shm->eventfd_fd() >= 0 ? ", eventfd" : "") << ")";
+        }
+        std::cout << std::endl;
+        std::cout << "    Daemon: ";
+        if (server_) {
+            std::cout << "✓ (" << server_->path() << ", " << options_.daemon_rate_hz << " Hz max)";
+        } else {
+            std::cout << "✗";
+        }
+        std::cout << std::endl;
+        std::cout << "    Idle mode: ";
+        if (options_.idle_after_s > 0.0f) {
+            std::cout << "✓ (after " << options_.idle_after_s << "s of silence)";
+        } else {
+            std::cout << "✗";
+        }
+        std::cout << std::endl;
+        std::cout << "    Quantum matching: ";
+        if (options_.quantum_hops > 0) {
+            std::cout << "✓ (" << options_.quantum_hops * analyzer.buf_size() << " frames requested)";
+        } else {
+            std::cout << "✗ (graph default)";
+        }
+        std::cout << std::endl;
+        std::cout << "    Overload shedding: ";
+        if (options_.degrade_step_ms > 0.0f) {
+            std::cout << "✓ (a stage per " << options_.degrade_step_ms << " ms of backlog, down to "
+                      << degrade_name(options_.degrade_limit) << ")";
+        } else {
+            std::cout << "✗";
+        }
+        std::cout << std::endl;
         std::cout << "    Confidence gating: ✓" << std::endl;
         std::cout << "    BPM stability tracking: ✓" << std::endl;
+        if (options_.enable_performance_stats) {
+            std::cout << "   Latency report: kill -USR1 " << getpid();
+            if (options_.stats_interval_s > 0.0f) std::cout << " or every " << options_.stats_interval_s << "s";
+            std::cout << std::endl;
+        }
+        if (stdin_source_ || server_) {
+            std::cout << "   󰒓 Live settings: SET/CONFIG on "
+                      << (stdin_source_ ? (server_ ? "stdin or the socket" : "stdin") : "the socket") << std::endl;
+        }
         std::cout << "\n Listening for beats... Press Ctrl+C to stop.\n" << std::endl;
     }
     
     void print_final_stats() {
-        if (!enable_performance_stats_) return;
+        if (!options_.enable_performance_stats || !ok_) return;
         
         auto end_time = std::chrono::steady_clock::now();
         auto duration = std::chrono::duration_cast<std::chrono::seconds>(end_time - start_time_);
         
         std::cout << "\n  Final Statistics:" << std::endl;
         std::cout << "   󱎫  Total runtime: " << duration.count() << " seconds" << std::endl;
-        std::cout << "    Total beats detected: " << total_beats_ << std::endl;
-        std::cout << "    Total frames processed: " << frame_count_ << std::endl;
-        
-        if (frame_count_ > 0) {
-            float beats_per_second = static_cast<float>(total_beats_) / duration.count();
-            std::cout << "    Detection rate: " << std::fixed << std::setprecision(2) 
-                      << beats_per_second << " beats/sec" << std::endl;
+        if (logger_) {
+            std::cout << "    Log records dropped (queue full): " << logger_->dropped() << std::endl;
         }
+#ifdef BD_TRACK_ALLOCS
+        std::cout << "    RT-path allocations: " << alloc_tracking::count() << std::endl;
+#endif
         
-        if (!process_times_.empty()) {
-            double avg_time = 0;
-            for (double t : process_times_) avg_time += t;
-            avg_time /= process_times_.size();
+        for (const auto& src : sources_) {
+            if (!src->analyzer.get()) continue;     // startup failed before it was built
+            const BeatAnalyzer& analyzer = *src->analyzer.get();
+            
+            if (sources_.size() > 1) std::cout << "   " << label(*src) << std::endl;
+            std::cout << "    Total beats detected: " << analyzer.total_beats() << std::endl;
+            std::cout << "    Time to first beat: " << warmup_timeline(src->warmup) << std::endl;
+            std::cout << "    Total frames processed: " << analyzer.frame_count() << std::endl;
+            if (const PitchWorker* pitch = analyzer.pitch_worker()) {
+                std::cout << "    Pitch estimates: " << pitch->completed() << " (" << pitch->skipped()
+                          << " skipped, worker busy)" << std::endl;
+            }
+            if (const BandOnsets* bands = analyzer.bands()) {
+                std::cout << "    Band events:";
+                for (uint32_t b = 0; b < BandOnsets::COUNT; ++b) {
+                    std::cout << " " << BandOnsets::BANDS[b].name << " " << bands->total(b);
+                }
+                std::cout << std::endl;
+            }
+            print_overload_report(*src);
+            if (uint64_t dropped = src->console_dropped.load()) {
+                std::cout << "    Console lines dropped (terminal too slow): " << dropped << std::endl;
+            }
+            if (uint64_t dropped = src->bars_dropped.load()) {
+                std::cout << "    Bars lines dropped (stdout reader too slow): " << dropped << std::endl;
+            }
             
-            auto max_time = *std::max_element(process_times_.begin(), process_times_.end());
-            auto min_time = *std::min_element(process_times_.begin(), process_times_.end());
+            if (analyzer.frame_count() > 0) {
+                float beats_per_second = static_cast<float>(analyzer.total_beats()) / duration.count();
+                std::cout << "    Detection rate: " << std::fixed << std::setprecision(2)
+                          << beats_per_second << " beats/sec" << std::endl;
+            }
             
-            std::cout << "   ⚡ Average processing time: " << std::fixed << std::setprecision(3) 
-                      << avg_time << " ms" << std::endl;
-            std::cout << "   📈 Max processing time: " << max_time << " ms" << std::endl;
-            std::cout << "   📉 Min processing time: " << min_time << " ms" << std::endl;
-        }
-        
-        if (!recent_bpms_.empty()) {
-            std::cout << "   󰝚 Final average BPM: " << std::fixed << std::setprecision(1) 
-                      << get_average_bpm() << std::endl;
-        }
-    }
-    
-    float get_average_bpm() const {
-        if (recent_bpms_.empty()) return 0.0f;
-        float sum = 0;
-        for (float bpm : recent_bpms_) sum += bpm;
-        return sum / recent_bpms_.size();
-    }
-    
-    float get_bpm_variance() const {
-        if (bpm_stability_.empty()) return 999.0f;
-        float mean = 0.0f;
-        for (float bpm : bpm_stability_) mean += bpm;
-        mean /= bpm_stability_.size();
-        
-        float variance = 0.0f;
-        for (float bpm : bpm_stability_) {
-            variance += (bpm - mean) * (bpm - mean);
+            analyzer.print_latency_report(std::cout, &src->callback_latency);
+            
+            if (analyzer.has_bpm_history()) {
+                std::cout << "   󰝚 Final average BPM: " << std::fixed << std::setprecision(1)
+                          << analyzer.get_average_bpm() << std::endl;
+            }
         }
-        return std::sqrt(variance / bpm_stability_.size());
     }
     
-    bool setup_stream() {
+    bool setup_stream(Source& src) {
         static const pw_stream_events stream_events = {
             .version = PW_VERSION_STREAM_EVENTS,
             .destroy = nullptr,
             .state_changed = on_state_changed,
             .control_info = nullptr,
             .io_changed = nullptr,
-            .param_changed = nullptr,
+            .param_changed = on_param_changed,
             .add_buffer = nullptr,
             .remove_buffer = nullptr,
             .process = on_process,
@@ -332,46 +4512,68 @@ private:
             .trigger_done = nullptr,
         };
         
-        stream_ = pw_stream_new_simple(
+        pw_properties* props = pw_properties_new(
+            PW_KEY_MEDIA_TYPE, "Audio",
+            PW_KEY_MEDIA_CATEGORY, "Capture",
+            PW_KEY_MEDIA_ROLE, "DSP",
+            nullptr
+        );
+        
+        // "sink" is the default sink's monitor and "mic" the default source;
+        // anything else (a node name or serial: a device, or an application's
+        // playback stream) is left to the session manager to link
+        if (src.target == "sink") {
+            pw_properties_set(props, PW_KEY_STREAM_CAPTURE_SINK, "true");
+        } else if (src.target != "mic") {
+            pw_properties_set(props, PW_KEY_TARGET_OBJECT, src.target.c_str());
+        }
+        
+        // Ask for a quantum of whole hops, so every callback is analysed in
+        // place and the partial-hop accumulator is never touched
+        std::string latency = requested_latency(src);
+        if (!latency.empty()) {
+            pw_properties_set(props, PW_KEY_NODE_LATENCY, latency.c_str());
+        }
+        
+        std::string name = "enhanced-beat-detector";
+        if (src.index > 0) name += "-" + std::to_string(src.index);
+        src.stream = pw_stream_new_simple(
             pw_main_loop_get_loop(main_loop_),
-            "enhanced-beat-detector",
-            pw_properties_new(
-                PW_KEY_MEDIA_TYPE, "Audio",
-                PW_KEY_MEDIA_CATEGORY, "Capture",
-                PW_KEY_MEDIA_ROLE, "DSP",
-                PW_KEY_STREAM_CAPTURE_SINK, "true",
-                nullptr
-            ),
+            name.c_str(),
+            props,
             &stream_events,
-            this
+            &src
         );
         
-        if (!stream_) {
-            std::cerr << " Failed to create stream" << std::endl;
+        if (!src.stream) {
+            std::cerr << " Failed to create stream for " << src.target << std::endl;
             return false;
         }
         
         uint8_t buffer[1024];
         spa_pod_builder pod_builder = SPA_POD_BUILDER_INIT(buffer, sizeof(buffer));
         
+        // Only the sample format is fixed: leaving rate and channels unset lets
+        // the graph hand us its native layout, with no resampler or channelmix
+        // in front of this stream. The result arrives in param_changed.
         struct spa_audio_info_raw audio_info = {};
         audio_info.format = SPA_AUDIO_FORMAT_F32_LE;
-        audio_info.channels = CHANNELS;
-        audio_info.rate = SAMPLE_RATE;
         audio_info.flags = 0;
         
         const spa_pod* params[1];
         params[0] = spa_format_audio_raw_build(&pod_builder, SPA_PARAM_EnumFormat, &audio_info);
         
-        if (pw_stream_connect(stream_,
+        // A daemon captures nothing until its first subscriber arrives
+        if (pw_stream_connect(src.stream,
                              PW_DIRECTION_INPUT,
                              PW_ID_ANY,
                              static_cast<pw_stream_flags>(
                                  PW_STREAM_FLAG_AUTOCONNECT |
                                  PW_STREAM_FLAG_MAP_BUFFERS |
-                                 PW_STREAM_FLAG_RT_PROCESS),
+                                 PW_STREAM_FLAG_RT_PROCESS |
+                                 (server_ ? PW_STREAM_FLAG_INACTIVE : 0)),
                              params, 1) < 0) {
-            std::cerr << " Failed to connect stream" << std::endl;
+            std::cerr << " Failed to connect stream for " << src.target << std::endl;
             return false;
         }
         
@@ -380,7 +4582,8 @@ private:
     
     static void on_state_changed(void* userdata, enum pw_stream_state,
                                 enum pw_stream_state state, const char* error) {
-        auto* detector = static_cast<EnhancedBeatDetector*>(userdata);
+        auto& src = *static_cast<Source*>(userdata);
+        EnhancedBeatDetector* detector = src.detector;
         
         const char* state_emoji = "󰑓 ";
         switch (state) {
@@ -391,7 +4594,16 @@ private:
             case PW_STREAM_STATE_UNCONNECTED: state_emoji = "✗ "; break;
         }
         
-        std::cout << state_emoji << " Stream state: " << pw_stream_state_as_string(state) << std::endl;
+        // The node id tags this source's output; it is known once the node exists
+        if (state == PW_STREAM_STATE_PAUSED || state == PW_STREAM_STATE_STREAMING) {
+            src.node_id.store(pw_stream_get_node_id(src.stream), std::memory_order_relaxed);
+        }
+        if (state == PW_STREAM_STATE_STREAMING) {
+            src.cycle_reset.store(true, std::memory_order_relaxed);
+            src.warmup.streaming_ns.store(clock_ns(CLOCK_MONOTONIC), std::memory_order_relaxed);
+        }
+        
+        std::cout << state_emoji << " " << detector->label(src) << "Stream state: " << pw_stream_state_as_string(state) << std::endl;
         
         if (state == PW_STREAM_STATE_ERROR) {
             std::cerr << " Stream error: " << (error ? error : "unknown") << std::endl;
@@ -399,171 +4611,747 @@ private:
         }
     }
     
+    static void on_param_changed(void* userdata, uint32_t id, const spa_pod* param) {
+        auto& src = *static_cast<Source*>(userdata);
+        src.detector->format_changed(src, id, param);
+    }
+    
+    void format_changed(Source& src, uint32_t id, const spa_pod* param) {
+        if (!param || id != SPA_PARAM_Format) return;
+        
+        uint32_t media_type, media_subtype;
+        if (spa_format_parse(param, &media_type, &media_subtype) < 0
+            || media_type != SPA_MEDIA_TYPE_audio || media_subtype != SPA_MEDIA_SUBTYPE_raw) {
+            return;
+        }
+        
+        spa_audio_info_raw info = {};
+        if (spa_format_audio_raw_parse(param, &info) < 0 || info.rate == 0 || info.channels == 0) {
+            std::cerr << " " << label(src) << "Unusable stream format, keeping " << src.analyzer_rate << " Hz" << std::endl;
+            return;
+        }
+        
+        src.channels.store(info.channels, std::memory_order_relaxed);
+        src.rate.store(info.rate, std::memory_order_relaxed);
+        std::cout << " " << label(src) << "Format: " << info.rate << " Hz, " << info.channels << " channel(s)";
+        if (info.channels > 1) std::cout << " → mono (" << downmix_.name << ")";
+        std::cout << std::endl;
+        
+        startup_cache_.remember(src.target, info.rate);
+        if (info.rate == src.analyzer_rate) return;
+        
+        // Latency fractions are rate-relative: restate them at the real rate
+        if (options_.quantum_hops > 0 || src.idle_applied) {
+            src.analyzer_rate = info.rate;
+            update_latency(src);
+        }
+        
+        // Tempo, onset and bar tables depend on the rate: build a fresh
+        // pipeline here and let the analysing thread pick it up between buffers
+        std::unique_ptr<BeatAnalyzer> analyzer = make_analyzer(config_, info.rate, &src);
+        if (!analyzer->initialize()) {
+            std::cerr << " Failed to rebuild the analyser for " << info.rate << " Hz" << std::endl;
+            stop();
+            return;
+        }
+        src.analyzer.post(std::move(analyzer));
+        src.analyzer_rate = info.rate;
+    }
+    
     static void on_process(void* userdata) {
-        auto* detector = static_cast<EnhancedBeatDetector*>(userdata);
-        detector->process_audio();
+        auto& src = *static_cast<Source*>(userdata);
+        src.detector->process_audio(src);
     }
     
-    void process_audio() {
+    void process_audio(Source& src) {
         if (should_quit_) return;
+        [[maybe_unused]] RtScope rt;
         
-        auto process_start = std::chrono::high_resolution_clock::now();
+        uint64_t process_start = clock_ns(CLOCK_MONOTONIC);
         
-        pw_buffer* buffer = pw_stream_dequeue_buffer(stream_);
-        if (!buffer) return;
+        pw_buffer* buffer = pw_stream_dequeue_buffer(src.stream);
+        if (!buffer) {
+            src.null_buffers.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
         
         spa_buffer* spa_buf = buffer->buffer;
         if (!spa_buf->datas[0].data) {
-            pw_stream_queue_buffer(stream_, buffer);
+            pw_stream_queue_buffer(src.stream, buffer);
             return;
         }
         
         const float* audio_data = static_cast<const float*>(spa_buf->datas[0].data);
-        const uint32_t n_samples = spa_buf->datas[0].chunk->size / sizeof(float);
+        const uint32_t channels = src.channels.load(std::memory_order_relaxed);
+        const uint32_t n_frames = spa_buf->datas[0].chunk->size / (sizeof(float) * channels);
+        if (n_frames != src.quantum_frames.load(std::memory_order_relaxed)) {
+            src.quantum_frames.store(n_frames, std::memory_order_relaxed);
+            notify(src, NOTIFY_QUANTUM);
+        }
+        const uint32_t rate = src.rate.load(std::memory_order_relaxed);
+        const uint64_t period_ns = static_cast<uint64_t>(n_frames) * 1000000000ull / rate;
+        BeatAnalyzer* analyzer = pooled_ ? nullptr : acquire_analyzer(src);
+        if (!pooled_ && !analyzer) {
+            pw_stream_queue_buffer(src.stream, buffer);    // still starting up
+            return;
+        }
+        if (analyzer) set_degrade(src, *analyzer, src.governor.update(src.callback_backlog_ns, period_ns));
         
-        // Accumulate samples into circular buffer
-        for (uint32_t i = 0; i < n_samples; ++i) {
-            sample_accumulator_[accumulated_samples_++] = audio_data[i];
+        // Beat times come from the graph clock rather than from when we got
+        // around to analysing: the cycle time minus the capture delay (which
+        // includes the quantum) marks the first frame of this buffer, and each
+        // hop is offset from there by its position in samples
+        uint64_t capture_ns = 0;
+        pw_time time;
+        if (pw_stream_get_time_n(src.stream, &time, sizeof(time)) == 0 && time.now > 0 && time.rate.denom > 0) {
+            int64_t delay_ns = time.delay * 1000000000ll * time.rate.num / time.rate.denom;
+            capture_ns = static_cast<uint64_t>(time.now - delay_ns);
+            track_cycle(src, static_cast<uint64_t>(time.now), period_ns);
+        }
+        if (pooled_ && capture_ns) {
+            TimeAnchor anchor{src.frames_written, capture_ns};
+            src.anchors->write(&anchor, 1);             // a full ring just means a slightly older anchor
+        }
+        
+        if (channels == 1) {
+            deliver(src, analyzer, audio_data, n_frames, capture_ns);
+        } else {
+            for (uint32_t pos = 0; pos < n_frames; pos += DOWNMIX_FRAMES) {
+                uint32_t n = std::min(DOWNMIX_FRAMES, n_frames - pos);
+                downmix_.mix(src.downmix_buffer.data(), audio_data + static_cast<size_t>(pos) * channels, n, channels);
+                deliver(src, analyzer, src.downmix_buffer.data(), n,
+                        capture_ns ? capture_ns + static_cast<uint64_t>(pos) * 1000000000ull / rate : 0);
+            }
+        }
+        pw_stream_queue_buffer(src.stream, buffer);
+        if (pooled_) sem_post(&work_sem_);
+        
+        // In-callback analysis has one quantum to finish in; time beyond
+        // that is owed, and paid back by the callbacks that finish early
+        uint64_t elapsed = clock_ns(CLOCK_MONOTONIC) - process_start;
+        if (analyzer) {
+            if (elapsed > period_ns) src.overlong_callbacks.fetch_add(1, std::memory_order_relaxed);
+            src.callback_backlog_ns = src.callback_backlog_ns + elapsed > period_ns
+                ? src.callback_backlog_ns + elapsed - period_ns : 0;
+        }
+        
+        // Performance tracking
+        if (options_.enable_performance_stats) {
+            src.callback_latency.record(elapsed);
+        }
+    }
+    
+    // RT thread: count the quanta the graph skipped us for since the last cycle
+    void track_cycle(Source& src, uint64_t cycle_ns, uint64_t period_ns) {
+        if (src.cycle_reset.exchange(false, std::memory_order_relaxed)) src.last_cycle_ns = 0;
+        if (src.last_cycle_ns && cycle_ns > src.last_cycle_ns) {
+            // A quantum change shows up as one odd gap, so judge by the longer period
+            uint64_t expected = std::max(period_ns, src.last_period_ns);
+            uint64_t gap = cycle_ns - src.last_cycle_ns;
+            if (expected > 0 && gap * 2 > expected * 3) {
+                src.late_callbacks.fetch_add(1, std::memory_order_relaxed);
+                src.missed_quanta.fetch_add((gap + expected / 2) / expected - 1, std::memory_order_relaxed);
+            }
+        }
+        src.last_cycle_ns = cycle_ns;
+        src.last_period_ns = period_ns;
+    }
+    
+    // Analysing thread: apply the governor's level, and tell the main loop when it moves
+    void set_degrade(Source& src, BeatAnalyzer& analyzer, Degrade level) {
+        analyzer.set_degrade(level);
+        if (level != src.reported_degrade_rt) {
+            src.reported_degrade_rt = level;
+            notify(src, NOTIFY_DEGRADE);
+        }
+    }
+    
+    // Mono samples either go straight into the analyser or, with the pool,
+    // through a bounded copy into the source's ring
+    void deliver(Source& src, BeatAnalyzer* analyzer, const float* samples, uint32_t n_samples, uint64_t capture_ns) {
+        if (analyzer) {
+            analyzer->feed_samples(samples, n_samples, capture_ns);
+            return;
+        }
+        size_t written = src.sample_ring->write(samples, n_samples);
+        src.frames_written += written;
+        if (written < n_samples) {
+            src.ring_overruns.fetch_add(1, std::memory_order_relaxed);
+            src.dropped_samples.fetch_add(n_samples - written, std::memory_order_relaxed);
+        }
+    }
+    
+    void worker_loop(size_t worker) {
+        const size_t n = sources_.size();
+        while (!should_quit_) {
+            if (sem_wait(&work_sem_) != 0 && errno == EINTR) continue;
             
-            if (accumulated_samples_ >= buf_size_) {
-                std::memcpy(input_buffer_->data, sample_accumulator_.data(), buf_size_ * sizeof(float));
-                
-                // Check signal amplitude to gate silence
-                float max_amplitude = 0.0f;
-                float rms_energy = 0.0f;
-                for (uint32_t j = 0; j < buf_size_; ++j) {
-                    max_amplitude = std::max(max_amplitude, std::abs(input_buffer_->data[j]));
-                    rms_energy += input_buffer_->data[j] * input_buffer_->data[j];
-                }
-                rms_energy = std::sqrt(rms_energy / buf_size_);
-                
-                frame_count_++;
-                
-                // Only process if above silence threshold
-                if (max_amplitude < SILENCE_THRESHOLD) {
-                    if (frame_count_ % 200 == 0) {
-                        std::cout << " [SILENCE] Frame #" << frame_count_ 
-                                  << " (amp: " << std::fixed << std::setprecision(4) << max_amplitude << ")" << std::endl;
-                    }
-                    accumulated_samples_ = 0;
-                    continue;
-                }
-                
-                // Adaptive threshold based on signal energy
-                float adaptive_threshold = 0.15f + (0.15f * rms_energy);
-                aubio_onset_set_threshold(onset_.get(), std::min(adaptive_threshold, 0.3f));
-                
-                // Process audio with aubio
-                aubio_tempo_do(tempo_.get(), input_buffer_.get(), output_buffer_.get());
-                float current_bpm = aubio_tempo_get_bpm(tempo_.get());
-                float tempo_confidence = aubio_tempo_get_confidence(tempo_.get());
-                
-                // Use ONSET as primary beat source (more reliable)
-                aubio_onset_do(onset_.get(), input_buffer_.get(), output_buffer_.get());
-                bool is_onset = output_buffer_->data[0] != 0.0f;
-                
-                float pitch_hz = 0.0f;
-                if (enable_pitch_detection_) {
-                    aubio_pitch_do(pitch_.get(), input_buffer_.get(), pitch_buffer_.get());
-                    pitch_hz = pitch_buffer_->data[0];
-                }
-                
-                // BPM smoothing with validity checking
-                if (current_bpm > BPM_MIN && current_bpm < BPM_MAX) {
-                    smoothed_bpm_ = 0.7f * smoothed_bpm_ + 0.3f * current_bpm;
-                } else if (smoothed_bpm_ == 0.0f) {
-                    smoothed_bpm_ = current_bpm;
-                }
-                
-                // Trust beat only if both onset detected AND tempo confident
-                bool is_beat = is_onset && tempo_confidence > CONFIDENCE_THRESHOLD;
-                
-                // Debug output every 200 frames
-                if (frame_count_ % 200 == 0) {
-                    std::cout << " [DEBUG] Frame #" << frame_count_ 
-                              << " | Amp: " << std::fixed << std::setprecision(4) << max_amplitude
-                              << " | BPM: " << std::setprecision(1) << smoothed_bpm_
-                              << " | Conf: " << std::setprecision(2) << tempo_confidence
-                              << " | Beat: " << (is_beat ? "YES" : "NO") << std::endl;
+            // Own sources first (index % pool size), then steal from the rest.
+            // Sweep until a pass finds nothing: a source skipped because
+            // another worker held it is rechecked by that worker after it lets go.
+            bool found = true;
+            while (found && !should_quit_) {
+                found = false;
+                for (size_t i = worker; i < n; i += pool_size_) {
+                    found |= analyse_slice(*sources_[i]);
                 }
-                
-                // Beat detection
-                if (is_beat) {
-                    total_beats_++;
-                    last_beat_time_ = std::chrono::steady_clock::now();
-                    
-                    recent_bpms_.push_back(smoothed_bpm_);
-                    if (recent_bpms_.size() > BPM_HISTORY_SIZE) {
-                        recent_bpms_.erase(recent_bpms_.begin());
-                    }
-                    
-                    // Track BPM stability
-                    bpm_stability_.push_back(smoothed_bpm_);
-                    if (bpm_stability_.size() > STABILITY_WINDOW) {
-                        bpm_stability_.erase(bpm_stability_.begin());
-                    }
-                    
-                    float variance = get_bpm_variance();
-                    bool is_stable = variance < BPM_VARIANCE_LIMIT;
-                    
-                    if (enable_visual_feedback_) {
-                        std::cout << generate_beat_visual(smoothed_bpm_, tempo_confidence, true) << std::flush;
-                    } else {
-                        std::cout << " 🎵 BEAT! BPM: " << std::fixed << std::setprecision(1) 
-                                  << smoothed_bpm_ << " | Conf: " << std::setprecision(2) 
-                                  << tempo_confidence;
-                        if (is_stable) {
-                            std::cout << " | STABLE";
-                        }
-                        std::cout << std::endl;
-                    }
-                    
-                    // Logging
-                    if (enable_logging_ && log_file_.is_open()) {
-                        auto now = std::chrono::system_clock::now();
-                        auto time_t = std::chrono::system_clock::to_time_t(now);
-                        auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
-                            now.time_since_epoch()) % 1000;
-                        
-                        log_file_ << std::put_time(std::localtime(&time_t), "%H:%M:%S") 
-                                 << "." << std::setfill('0') << std::setw(3) << ms.count() << ","
-                                 << std::fixed << std::setprecision(1) << smoothed_bpm_ << ","
-                                 << std::setprecision(2) << tempo_confidence << ","
-                                 << pitch_hz << ","
-                                 << std::setprecision(4) << max_amplitude << ","
-                                 << get_bpm_variance() << "\n";
-                        log_file_.flush();
-                    }
+                for (size_t k = 1; k <= n; ++k) {
+                    size_t i = (worker + k) % n;
+                    if (i % pool_size_ != worker) found |= analyse_slice(*sources_[i]);
                 }
-                
-                total_onsets_++;
-                accumulated_samples_ = 0;
             }
         }
+    }
+    
+    // Claim a source and analyse at most STEAL_SLICE samples of its ring,
+    // straight out of the ring one contiguous run at a time. The claim keeps
+    // the ring and the analyser single-consumer across workers.
+    bool analyse_slice(Source& src) {
+        if (src.sample_ring->read_available() == 0) return false;
+        if (src.busy.exchange(true, std::memory_order_acquire)) return false;
+        [[maybe_unused]] RtScope rt;
+        
+        BeatAnalyzer* analyzer = acquire_analyzer(src);
+        if (!analyzer) {
+            src.busy.store(false, std::memory_order_release);   // still starting up; the ring waits
+            return false;
+        }
+        while (src.anchors->read(&src.anchor, 1) == 1) {}
+        const double ns_per_sample = 1e9 / analyzer->sample_rate();
+        
+        // The backlog is whatever is queued beyond this slice
+        size_t queued = src.sample_ring->read_available();
+        size_t slice = std::min(queued, STEAL_SLICE);
+        set_degrade(src, *analyzer, src.governor.update(static_cast<uint64_t>((queued - slice) * ns_per_sample),
+                                                        static_cast<uint64_t>(slice * ns_per_sample)));
+        
+        size_t budget = STEAL_SLICE;
+        size_t n;
+        for (const float* run = src.sample_ring->peek(n); n > 0 && budget > 0; run = src.sample_ring->peek(n)) {
+            n = std::min(n, budget);
+            uint64_t capture_ns = 0;
+            if (src.anchor.capture_ns) {
+                double offset = static_cast<double>(static_cast<int64_t>(src.frames_read - src.anchor.frame));
+                capture_ns = src.anchor.capture_ns + static_cast<int64_t>(offset * ns_per_sample);
+            }
+            analyzer->feed_samples(run, static_cast<uint32_t>(n), capture_ns);
+            src.sample_ring->consume(n);
+            src.frames_read += n;
+            budget -= n;
+        }
+        
+        src.busy.store(false, std::memory_order_release);
+        return true;
+    }
+    
+    // Analysing thread: flag the notice and wake the main loop
+    void notify(Source& src, uint32_t flag) {
+        src.notify_flags.fetch_or(flag, std::memory_order_release);
+        pw_loop_signal_event(pw_main_loop_get_loop(main_loop_), notify_event_);
+    }
+    
+    static void on_notify_event(void* userdata, uint64_t) {
+        auto* detector = static_cast<EnhancedBeatDetector*>(userdata);
+        for (auto& src : detector->sources_) {
+            uint32_t flags = src->notify_flags.exchange(0, std::memory_order_acquire);
+            if (flags & NOTIFY_IDLE) detector->apply_idle(*src);
+            if (flags & NOTIFY_QUANTUM) detector->report_quantum(*src);
+            if (flags & NOTIFY_SUBSCRIBERS) detector->send_updates(*src);
+            if (flags & NOTIFY_FLIGHT_DUMP) detector->dump_flight(*src);
+            if (flags & NOTIFY_DEGRADE) detector->report_degrade(*src);
+            if (flags & NOTIFY_FIRST_BEAT) detector->report_warmup(*src);
+        }
+    }
+    
+    // Main loop: reference-counted capture, like the QML services' refCount
+    void on_subscribers(size_t count) {
+        bool was_on = has_subscribers_.exchange(count > 0, std::memory_order_relaxed);
+        for (auto& src : sources_) {
+            if (src->stream) pw_stream_set_active(src->stream, count > 0);
+            if (count > 0 && !was_on) src->warmup.restart(clock_ns(CLOCK_MONOTONIC));
+        }
+        std::cout << "󰀲 Subscribers: " << count << " (capture " << (count > 0 ? "on" : "off") << ")" << std::endl;
+    }
+    
+    // Main loop: the --shm-eventfd of the primary source or of the source
+    // currently on `node_id`, for EVENTFD on the daemon socket
+    int shm_eventfd(uint32_t node_id, bool primary) const {
+        for (const auto& src : sources_) {
+            if (primary ? src->index != 0 : src->node_id.load(std::memory_order_relaxed) != node_id) continue;
+            return src->shm ? src->shm->eventfd_fd() : -1;
+        }
+        return -1;
+    }
+    
+    // Main loop: a control command from stdin or a daemon client, and the
+    // reply line. SET changes config_; settings the analyser's objects or
+    // tables depend on rebuild every source's analyser here, off the
+    // analysing threads, and the new one takes over between two blocks
+    // without touching the stream. Thresholds alone are posted as a new
+    // Tuning and applied to the running analyser.
+    std::string control(const std::string& line) {
+        std::istringstream words(line);
+        std::string command, list;
+        words >> command >> list;
+        if (command == "CONFIG") return "CONFIG " + describe_config(config_) + "\n";
+        if (command != "SET" || list.empty()) return "ERR usage: SET <key>=<value>[,...] | CONFIG\n";
+        
+        AnalysisConfig next = config_;
+        std::istringstream items(list);
+        std::string item;
+        while (std::getline(items, item, ',')) {
+            std::string error = apply_setting(next, item);
+            if (!error.empty()) return "ERR " + error + "\n";
+        }
+        
+        // Build every source's analyser first, so settings the pipeline
+        // rejects change nothing. Repeating the current values (a client
+        // that sets what it needs on every connect) rebuilds nothing.
+        const bool rebuild = !same_pipeline(next, config_);
+        if (rebuild) {
+            std::vector<std::unique_ptr<BeatAnalyzer>> built;
+            for (auto& src : sources_) {
+                built.push_back(make_analyzer(next, src->analyzer_rate, src.get()));
+                if (!built.back()->initialize()) return "ERR pipeline rejected " + list + "\n";
+            }
+            for (size_t i = 0; i < sources_.size(); ++i) sources_[i]->analyzer.post(std::move(built[i]));
+        }
+        const bool hop_changed = next.hop != config_.hop;
+        config_ = next;
+        for (auto& src : sources_) {
+            src->tuning.post(std::make_unique<BeatAnalyzer::Tuning>(config_.tuning));
+            if (hop_changed) update_latency(*src);
+        }
+        
+        std::cout << "󰒓 Settings: " << describe_config(config_) << (rebuild ? " (pipeline rebuilt)" : "") << std::endl;
+        return "OK " + list + "\n";
+    }
+    
+    static std::string describe_config(const AnalysisConfig& config) {
+        std::ostringstream out;
+        out << "hop=" << config.hop << " engine=" << engine_name(config.engine) << " decimate=" << config.decimation
+            << " pitch=" << (config.pitch ? "on" : "off") << " pitch-rate=" << config.pitch_rate_hz
+            << " bars=" << config.bar_count << " bands=" << (config.bands ? "on" : "off")
+            << " gate=" << std::fixed << std::setprecision(1) << 20.0f * std::log10(config.tuning.silence_gate)
+            << std::setprecision(3) << " onset=" << config.tuning.onset_threshold
+            << " tempo=" << config.tuning.tempo_threshold << " confidence=" << config.tuning.confidence
+            << std::setprecision(1) << " ioi=" << config.tuning.min_ioi_ms;
+        return out.str();
+    }
+    
+    static bool same_pipeline(const AnalysisConfig& a, const AnalysisConfig& b) {
+        return a.hop == b.hop && a.engine == b.engine && a.decimation == b.decimation && a.pitch == b.pitch
+            && a.pitch_rate_hz == b.pitch_rate_hz && a.bar_count == b.bar_count && a.bands == b.bands;
+    }
+    
+    // One key=value of a SET into `config`; returns the error, empty when valid
+    std::string apply_setting(AnalysisConfig& config, const std::string& item) const {
+        size_t eq = item.find('=');
+        if (eq == std::string::npos) return "expected key=value: " + item;
+        const std::string key = item.substr(0, eq);
+        const std::string value = item.substr(eq + 1);
+        
+        auto flag = [&](bool& out) {
+            if (value == "on" || value == "1") {
+                out = true;
+            } else if (value == "off" || value == "0") {
+                out = false;
+            } else {
+                return false;
+            }
+            return true;
+        };
+        auto number = [&](float& out, float min, float max) {
+            try {
+                size_t used;
+                float v = std::stof(value, &used);
+                if (used != value.size() || v < min || v > max) return false;
+                out = v;
+                return true;
+            } catch (...) {
+                return false;
+            }
+        };
+        
+        float v = 0.0f;
+        if (key == "hop") {
+            if (!number(v, 64, 8192) || v != std::floor(v)) return "hop must be 64-8192 samples";
+            uint32_t hop = static_cast<uint32_t>(v);
+            if (options_.quantum_hops > 0 && (hop & (hop - 1)) != 0) return "hop must be a power of two with --match-quantum";
+            config.hop = hop;
+        } else if (key == "engine") {
+            if (value == "aubio") {
+                config.engine = OnsetEngine::Aubio;
+            } else if (value == "flux") {
+                config.engine = OnsetEngine::Flux;
+            } else {
+                return "engine must be aubio or flux";
+            }
+        } else if (key == "decimate") {
+            if (value != "1" && value != "2" && value != "4" && value != "8") return "decimate must be 1, 2, 4 or 8";
+            config.decimation = static_cast<uint32_t>(std::stoul(value));
+        } else if (key == "pitch") {
+            if (!flag(config.pitch)) return "pitch must be on or off";
+        } else if (key == "pitch-rate") {
+            if (!number(config.pitch_rate_hz, 0.0f, 100.0f)) return "pitch-rate must be 0-100 Hz";
+        } else if (key == "bars") {
+            if (!number(v, 0, SpectrumBars::MAX_BARS) || v != std::floor(v)) {
+                return "bars must be 0-" + std::to_string(SpectrumBars::MAX_BARS);
+            }
+            config.bar_count = static_cast<uint32_t>(v);
+        } else if (key == "bands") {
+            if (!flag(config.bands)) return "bands must be on or off";
+        } else if (key == "gate") {
+            if (!number(v, -90.0f, 0.0f)) return "gate must be -90-0 dB";
+            config.tuning.silence_gate = std::pow(10.0f, v / 20.0f);
+        } else if (key == "onset") {
+            if (!number(config.tuning.onset_threshold, 0.01f, 1.0f)) return "onset must be 0.01-1";
+        } else if (key == "tempo") {
+            if (!number(config.tuning.tempo_threshold, 0.01f, 1.0f)) return "tempo must be 0.01-1";
+        } else if (key == "confidence") {
+            if (!number(config.tuning.confidence, 0.0f, 1.0f)) return "confidence must be 0-1";
+        } else if (key == "ioi") {
+            if (!number(config.tuning.min_ioi_ms, 0.0f, 1000.0f)) return "ioi must be 0-1000 ms";
+        } else {
+            return "unknown setting " + key;
+        }
+        return "";
+    }
+    
+    // Control commands typed or piped into stdin, one per line
+    static void on_stdin(void* userdata, int fd, uint32_t mask) {
+        auto* detector = static_cast<EnhancedBeatDetector*>(userdata);
+        char buffer[1024];
+        ssize_t n = read(fd, buffer, sizeof(buffer));
+        if (n > 0) {
+            detector->stdin_buffer_.append(buffer, static_cast<size_t>(n));
+        } else if (n == 0 || (errno != EAGAIN && errno != EINTR) || (mask & (SPA_IO_ERR | SPA_IO_HUP))) {
+            pw_loop_destroy_source(pw_main_loop_get_loop(detector->main_loop_), detector->stdin_source_);
+            detector->stdin_source_ = nullptr;
+            return;
+        }
+        
+        size_t eol;
+        while ((eol = detector->stdin_buffer_.find('\n')) != std::string::npos) {
+            std::string line = detector->stdin_buffer_.substr(0, eol);
+            detector->stdin_buffer_.erase(0, eol + 1);
+            if (line.find_first_not_of(" \t\r") == std::string::npos) continue;
+            std::string reply = detector->control(line);
+            if (reply.compare(0, 3, "OK ") != 0) std::cout << reply << std::flush;
+        }
+        if (detector->stdin_buffer_.size() > sizeof(buffer)) detector->stdin_buffer_.clear();
+    }
+    
+    void send_updates(Source& src) {
+        SubscriberUpdate update;
+        while (src.updates->read(&update, 1) == 1) {
+            update.snap.bars = update.bars.data();
+            server_->broadcast(update.snap, update.beats, update.band_beats, src.index == 0);
+        }
+    }
+    
+    // Analysing thread: coalesce like the shm channel, but never drop a beat
+    void queue_update(Source& src, const BeatSnapshot& snap) {
+        if (!has_subscribers_.load(std::memory_order_relaxed)) return;
+        if (snap.is_beat) src.pending_update_beats++;
+        for (uint32_t b = 0; b < BandOnsets::COUNT; ++b) {
+            if (snap.band_events & (1u << b)) src.pending_update_bands[b]++;
+        }
+        bool bands_pending = std::any_of(src.pending_update_bands.begin(), src.pending_update_bands.end(),
+                                         [](uint32_t n) { return n > 0; });
+        if (src.pending_update_beats == 0 && !bands_pending
+            && snap.time_ns - src.last_update_ns < update_interval_ns_) return;
+        
+        SubscriberUpdate update;
+        update.snap = snap;
+        update.beats = src.pending_update_beats;
+        update.band_beats = src.pending_update_bands;
+        std::copy_n(snap.bars, snap.bar_count, update.bars.begin());
+        if (src.updates->write(&update, 1) == 0) return;   // main loop is behind, retry next hop
+        
+        src.last_update_ns = snap.time_ns;
+        src.pending_update_beats = 0;
+        src.pending_update_bands = {};
+        notify(src, NOTIFY_SUBSCRIBERS);
+    }
+    
+    void set_idle(Source& src, bool idle) {
+        src.idle = idle;
+        src.want_idle.store(idle, std::memory_order_relaxed);
+        notify(src, NOTIFY_IDLE);
+    }
+    
+    // node.latency for active analysis; empty leaves the quantum to the graph
+    std::string requested_latency(const Source& src) const {
+        if (options_.quantum_hops == 0) return "";
+        return std::to_string(options_.quantum_hops * config_.hop) + "/" + std::to_string(src.analyzer_rate);
+    }
+    
+    void update_latency(Source& src) {
+        std::string latency = src.idle_applied
+            ? std::to_string(IDLE_LATENCY_FRAMES) + "/" + std::to_string(src.analyzer_rate)
+            : requested_latency(src);
+        
+        // Dropping the key hands the quantum back to the graph's default
+        spa_dict_item items[1] = { SPA_DICT_ITEM_INIT(PW_KEY_NODE_LATENCY, latency.empty() ? nullptr : latency.c_str()) };
+        spa_dict dict = SPA_DICT_INIT(items, 1);
+        pw_stream_update_properties(src.stream, &dict);
+    }
+    
+    void apply_idle(Source& src) {
+        bool idle = src.want_idle.load(std::memory_order_relaxed);
+        if (idle == src.idle_applied) return;
+        src.idle_applied = idle;
+        update_latency(src);
+        
+        if (idle) {
+            std::cout << "󰒲 " << label(src) << "Idle: " << options_.idle_after_s << "s of silence, requesting "
+                      << IDLE_LATENCY_FRAMES << "/" << src.analyzer_rate << " latency" << std::endl;
+        } else {
+            std::cout << "󰝚 " << label(src) << "Signal back, leaving idle mode" << std::endl;
+        }
+    }
+    
+    // Analysing thread: one clock read per milestone, none once all are reached
+    void mark_warmup(Source& src, const HopResult& hop) {
+        Warmup& warmup = src.warmup;
+        if (warmup.first_beat_ns.load(std::memory_order_relaxed)) return;
+        auto mark = [](std::atomic<uint64_t>& milestone) {
+            if (!milestone.load(std::memory_order_relaxed)) milestone.store(clock_ns(CLOCK_MONOTONIC), std::memory_order_relaxed);
+        };
+        mark(warmup.first_hop_ns);
+        if (!hop.silent) mark(warmup.first_sound_ns);
+        if (hop.is_beat) {
+            mark(warmup.first_beat_ns);
+            notify(src, NOTIFY_FIRST_BEAT);
+        }
+    }
+    
+    // Main loop: the startup timeline up to the first beat
+    void report_warmup(const Source& src) const {
+        std::cout << "󰓅 " << label(src) << "Time to first beat: " << warmup_timeline(src.warmup) << std::endl;
+    }
+    
+    static std::string warmup_timeline(const Warmup& warmup) {
+        auto at = [&](const std::atomic<uint64_t>& milestone) {
+            uint64_t ns = milestone.load(std::memory_order_relaxed);
+            std::ostringstream out;
+            out << std::fixed << std::setprecision(0);
+            if (ns == 0) {
+                out << "-";
+            } else {
+                out << (ns > warmup.start_ns ? (ns - warmup.start_ns) / 1e6 : 0.0) << " ms";
+            }
+            return out.str();
+        };
+        std::string beat = warmup.first_beat_ns.load(std::memory_order_relaxed) ? at(warmup.first_beat_ns) : "no beat yet";
+        return beat + " (streaming " + at(warmup.streaming_ns) + ", first audio " + at(warmup.first_hop_ns)
+            + ", first sound " + at(warmup.first_sound_ns) + ")";
+    }
+    
+    void report_degrade(Source& src) {
+        Degrade level = src.governor.level();
+        if (level == src.reported_degrade) return;
+        bool deeper = level > src.reported_degrade;
+        src.reported_degrade = level;
+        
+        std::cout << (deeper ? "⚠ " : "󰓅 ") << label(src) << "Analysis " << (deeper ? "degraded" : "restored")
+                  << " to " << degrade_name(level) << " (backlog " << std::fixed << std::setprecision(1)
+                  << src.governor.backlog_ns() / 1e6 << " ms)" << std::endl;
+    }
+    
+    void report_quantum(Source& src) {
+        uint32_t frames = src.quantum_frames.load(std::memory_order_relaxed);
+        if (frames == 0) return;
+        uint32_t hop = config_.hop;
+        
+        std::cout << "󰓅 " << label(src) << "Quantum: " << frames << " frames @ " << src.analyzer_rate << " Hz ("
+                  << std::fixed << std::setprecision(2) << frames * 1000.0 / src.analyzer_rate << " ms), ";
+        if (frames % hop == 0) {
+            std::cout << frames / hop << " hop(s) per callback" << std::endl;
+        } else {
+            std::cout << "not a multiple of the " << hop << "-sample hop (accumulator in use)" << std::endl;
+        }
+    }
+    
+    // Output side of every analysed hop: terminal, log and binary channel.
+    // Pool workers call this for different sources at once, so each terminal
+    // line is built first and written in one piece.
+    void on_hop(Source& src, const HopResult& hop) {
+        if (hop.flight_dump) notify(src, NOTIFY_FLIGHT_DUMP);
+        if (src.record_pending) settle_record(src, hop);
+        mark_warmup(src, hop);
+        
+        if (hop.silent) {
+            src.silent_hops++;
+            const BeatAnalyzer& analyzer = *src.analyzer.get();
+            if (!src.idle && options_.idle_after_s > 0.0f && src.silent_hops * analyzer.buf_size()
+                    >= options_.idle_after_s * analyzer.sample_rate()) {
+                set_idle(src, true);
+            }
+            if (!src.idle && hop.frame % 200 == 0) {
+                ConsoleEvent event;
+                event.kind = ConsoleEvent::Kind::Silence;
+                event.frame = hop.frame;
+                event.amplitude = hop.amplitude;
+                console_event(src, event);
+            }
+            publish(src, hop);
+            return;
+        }
         
-        pw_stream_queue_buffer(stream_, buffer);
+        src.silent_hops = 0;
+        if (src.idle) set_idle(src, false);
         
-        // Performance tracking
-        if (enable_performance_stats_) {
-            auto process_end = std::chrono::high_resolution_clock::now();
-            auto process_time = std::chrono::duration<double, std::milli>(process_end - process_start).count();
+        ConsoleEvent event;
+        event.frame = hop.frame;
+        event.amplitude = hop.amplitude;
+        event.bpm = hop.bpm;
+        event.confidence = hop.confidence;
+        event.average_bpm = hop.average_bpm;
+        event.is_beat = hop.is_beat;
+        event.is_stable = hop.is_stable;
+        
+        // Debug output every 200 frames
+        if (hop.frame % 200 == 0) {
+            event.kind = ConsoleEvent::Kind::Debug;
+            console_event(src, event);
+        }
+        
+        if (hop.is_beat) {
+            event.kind = ConsoleEvent::Kind::Beat;
+            console_event(src, event);
             
-            if (process_times_.size() < 1000) {
-                process_times_.push_back(process_time);
+            // Logging: fixed-size record, formatted and written by the logger thread
+            if (logger_) {
+                BeatRecord record{};
+                record.time_ns = hop.time_ns ? hop.time_ns : clock_ns(CLOCK_MONOTONIC);
+                record.bpm = hop.bpm;
+                record.confidence = hop.confidence;
+                record.pitch_hz = hop.pitch_hz;
+                record.amplitude = hop.amplitude;
+                record.variance = hop.variance;
+                record.source_id = src.node_id.load(std::memory_order_relaxed);
+                if (src.analyzer.get()->pitch_worker()) {
+                    if (src.record_pending) logger_->push(src.pending_record, src.index);
+                    src.pending_record = record;
+                    src.pending_record_sample = hop.sample_index;
+                    src.record_pending = true;
+                } else {
+                    logger_->push(record, src.index);
+                }
+            }
+        }
+        
+        publish(src, hop);
+    }
+    
+    // A held beat record is logged once the pitch worker has answered for its
+    // hop, or with the latest estimate after PITCH_WAIT_S without an answer
+    void settle_record(Source& src, const HopResult& hop) {
+        const BeatAnalyzer& analyzer = *src.analyzer.get();
+        bool answered = hop.pitch_fresh && hop.pitch_sample_index >= src.pending_record_sample;
+        bool waited = hop.sample_index >= src.pending_record_sample + PITCH_WAIT_S * analyzer.sample_rate();
+        if (!answered && !waited) return;
+        src.pending_record.pitch_hz = hop.pitch_hz;
+        logger_->push(src.pending_record, src.index);
+        src.record_pending = false;
+    }
+    
+    void publish(Source& src, const HopResult& hop) {
+        const bool bars_stdout = options_.bars_stdout && src.index == 0;
+        if (!src.shm && !server_ && !bars_stdout) return;
+        
+        BeatSnapshot snap;
+        snap.bpm = hop.bpm;
+        snap.confidence = hop.confidence;
+        snap.amplitude = hop.amplitude;
+        snap.pitch_hz = hop.pitch_hz;
+        snap.is_beat = hop.is_beat;
+        snap.is_stable = hop.is_stable;
+        snap.average_bpm = hop.average_bpm;
+        snap.median_bpm = hop.median_bpm;
+        snap.octave_bpm = hop.octave_bpm;
+        snap.bpm_deviation = hop.variance;
+        snap.source_id = src.node_id.load(std::memory_order_relaxed);
+        snap.time_ns = hop.time_ns ? hop.time_ns : clock_ns(CLOCK_MONOTONIC);
+        snap.beat_phase = hop.beat_phase;
+        snap.beat_period_ms = hop.beat_period_ms;
+        const BeatAnalyzer& analyzer = *src.analyzer.get();
+        if (hop.next_beat_sample) {
+            // Relative to the capture time of the hop, so analysis latency is already hidden
+            uint64_t hop_end = hop.sample_index + analyzer.buf_size();
+            snap.next_beat_ns = snap.time_ns + (hop.next_beat_sample - hop_end) * 1000000000ull / analyzer.sample_rate();
+        }
+        if (const SpectrumBars* bars = analyzer.bars()) {
+            snap.bars = bars->values();
+            snap.bar_count = bars->count();
+        }
+        if (analyzer.bands()) {
+            snap.has_bands = true;
+            snap.band_events = hop.band_events;
+            snap.band_levels = hop.band_levels;
+        }
+        if (src.shm) src.shm->publish(snap);
+        if (server_) queue_update(src, snap);
+        
+        // The renderer writes the line; a reader that stalls the pipe only
+        // costs dropped lines, never analysis time
+        if (bars_stdout && snap.bar_count > 0
+            && snap.time_ns - src.last_bars_stdout_ns >= bars_stdout_interval_ns_) {
+            src.last_bars_stdout_ns = snap.time_ns;
+            BarsLine line;
+            line.count = snap.bar_count;
+            for (uint32_t i = 0; i < snap.bar_count; ++i) {
+                line.values[i] = static_cast<uint8_t>(std::clamp(snap.bars[i], 0.0f, 1.0f) * 100.0f + 0.5f);
+            }
+            if (src.bars_lines->write(&line, 1) == 0) {
+                src.bars_dropped.fetch_add(1, std::memory_order_relaxed);
             }
         }
     }
     
     void cleanup() {
-        if (log_file_.is_open()) {
-            log_file_.close();
+        if (main_loop_) {
+            pw_loop* loop = pw_main_loop_get_loop(main_loop_);
+            if (stats_timer_) pw_loop_destroy_source(loop, stats_timer_);
+            if (stats_signal_) pw_loop_destroy_source(loop, stats_signal_);
+            if (record_signal_) pw_loop_destroy_source(loop, record_signal_);
+            if (stdin_source_) pw_loop_destroy_source(loop, stdin_source_);
+            stats_timer_ = stats_signal_ = record_signal_ = stdin_source_ = nullptr;
+        }
+        
+        // Stop the pool before tearing down the objects it uses
+        if (!workers_.empty()) {
+            should_quit_ = true;
+            for (size_t w = 0; w < workers_.size(); ++w) sem_post(&work_sem_);
+            for (auto& worker : workers_) worker.join();
+            workers_.clear();
+            sem_destroy(&work_sem_);
+        }
+        
+        // Beats still waiting for a pitch go out with the latest estimate
+        for (auto& src : sources_) {
+            if (logger_ && src->record_pending) logger_->push(src->pending_record, src->index);
+        }
+        logger_.reset();
+        
+        for (auto& src : sources_) {
+            src->shm.reset();
+            if (src->stream) {
+                pw_stream_destroy(src->stream);
+                src->stream = nullptr;
+            }
         }
         
-        if (stream_) {
-            pw_stream_destroy(stream_);
-            stream_ = nullptr;
+        // Nothing can signal the notify event once the streams and workers are gone
+        if (notify_event_) {
+            pw_loop_destroy_source(pw_main_loop_get_loop(main_loop_), notify_event_);
+            notify_event_ = nullptr;
         }
         
+        server_.reset();
+        
         if (core_) {
             pw_core_disconnect(core_);
             core_ = nullptr;
@@ -579,13 +5367,6 @@ private:
             main_loop_ = nullptr;
         }
         
-        tempo_.reset();
-        input_buffer_.reset();
-        output_buffer_.reset();
-        onset_.reset();
-        pitch_.reset();
-        pitch_buffer_.reset();
-        
         pw_deinit();
         
         std::cout << "\n Cleanup complete - All resources freed!" << std::endl;
@@ -596,27 +5377,686 @@ private:
 std::atomic<bool> EnhancedBeatDetector::should_quit_{false};
 EnhancedBeatDetector* EnhancedBeatDetector::instance_{nullptr};
 
+// Decoded mono audio for offline analysis
+struct AudioClip {
+    std::vector<float> samples;
+    uint32_t sample_rate = 0;
+    
+    // Set when the file is a --record flight dump
+    bool has_flight = false;
+    FlightHeader flight{};
+    std::vector<FlightHop> flight_hops;
+};
+
+// Minimal RIFF/WAVE reader: 8/16/24/32-bit PCM and 32/64-bit float,
+// including WAVE_FORMAT_EXTENSIBLE. Channels are averaged to mono.
+bool load_wav(const std::string& path, AudioClip& clip, std::string& error) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        error = "cannot open file";
+        return false;
+    }
+    
+    auto read_u16 = [&in]() { uint8_t b[2] = {}; in.read(reinterpret_cast<char*>(b), 2); return static_cast<uint16_t>(b[0] | b[1] << 8); };
+    auto read_u32 = [&in]() { uint8_t b[4] = {}; in.read(reinterpret_cast<char*>(b), 4); return static_cast<uint32_t>(b[0] | b[1] << 8 | b[2] << 16 | static_cast<uint32_t>(b[3]) << 24); };
+    
+    char riff[4], wave[4];
+    in.read(riff, 4);
+    read_u32();
+    in.read(wave, 4);
+    if (!in || std::memcmp(riff, "RIFF", 4) != 0 || std::memcmp(wave, "WAVE", 4) != 0) {
+        error = "not a RIFF/WAVE file";
+        return false;
+    }
+    
+    uint16_t format = 0, channels = 0, bits = 0;
+    uint32_t rate = 0;
+    std::vector<uint8_t> data;
+    while (in && data.empty()) {
+        char id[4];
+        in.read(id, 4);
+        uint32_t size = read_u32();
+        if (!in) break;
+        
+        if (std::memcmp(id, "fmt ", 4) == 0) {
+            format = read_u16();
+            channels = read_u16();
+            rate = read_u32();
+            read_u32();                       // byte rate
+            read_u16();                       // block align
+            bits = read_u16();
+            if (format == 0xfffe && size >= 26) {
+                read_u16();                   // cbSize
+                read_u16();                   // valid bits
+                read_u32();                   // channel mask
+                format = read_u16();          // sub-format GUID starts with the format tag
+                in.seekg(size - 26, std::ios::cur);
+            } else {
+                in.seekg(size - 16, std::ios::cur);
+            }
+        } else if (std::memcmp(id, "bdfr", 4) == 0 && size >= sizeof(FlightHeader)) {
+            in.read(reinterpret_cast<char*>(&clip.flight), sizeof(FlightHeader));
+            size_t hops = std::min<size_t>(clip.flight.hop_count, (size - sizeof(FlightHeader)) / sizeof(FlightHop));
+            clip.flight_hops.resize(hops);
+            in.read(reinterpret_cast<char*>(clip.flight_hops.data()), hops * sizeof(FlightHop));
+            clip.has_flight = in && clip.flight.version == FlightHeader::VERSION;
+            in.seekg(size - sizeof(FlightHeader) - hops * sizeof(FlightHop) + (size & 1), std::ios::cur);
+        } else if (std::memcmp(id, "data", 4) == 0) {
+            data.resize(size);
+            in.read(reinterpret_cast<char*>(data.data()), size);
+            data.resize(static_cast<size_t>(in.gcount()));
+        } else {
+            in.seekg(size + (size & 1), std::ios::cur);
+        }
+    }
+    
+    const bool is_float = format == 3 && (bits == 32 || bits == 64);
+    const bool is_pcm = format == 1 && (bits == 8 || bits == 16 || bits == 24 || bits == 32);
+    if (!is_float && !is_pcm) {
+        error = "unsupported WAV encoding (format " + std::to_string(format) + ", " + std::to_string(bits) + " bit)";
+        return false;
+    }
+    if (channels == 0 || rate == 0 || data.empty()) {
+        error = "missing fmt or data chunk";
+        return false;
+    }
+    
+    const size_t bytes = bits / 8;
+    const size_t frames = data.size() / (bytes * channels);
+    clip.sample_rate = rate;
+    clip.samples.assign(frames, 0.0f);
+    
+    const uint8_t* p = data.data();
+    for (size_t f = 0; f < frames; ++f) {
+        float sum = 0.0f;
+        for (uint16_t c = 0; c < channels; ++c, p += bytes) {
+            float v;
+            if (is_float && bits == 32) {
+                std::memcpy(&v, p, 4);
+            } else if (is_float) {
+                double d;
+                std::memcpy(&d, p, 8);
+                v = static_cast<float>(d);
+            } else if (bits == 8) {
+                v = (p[0] - 128) / 128.0f;
+            } else if (bits == 16) {
+                v = static_cast<int16_t>(p[0] | p[1] << 8) / 32768.0f;
+            } else if (bits == 24) {
+                int32_t s = (p[0] << 8 | p[1] << 16 | p[2] << 24) >> 8;
+                v = s / 8388608.0f;
+            } else {
+                int32_t s = static_cast<int32_t>(p[0] | p[1] << 8 | p[2] << 16 | static_cast<uint32_t>(p[3]) << 24);
+                v = s / 2147483648.0f;
+            }
+            sum += v;
+        }
+        clip.samples[f] = sum / channels;
+    }
+    return true;
+}
+
+// Any other format (FLAC, MP3, ...) is decoded by ffmpeg to mono float at `rate`
+bool load_with_ffmpeg(const std::string& path, uint32_t rate, AudioClip& clip, std::string& error) {
+    std::string quoted = "'";
+    for (char c : path) quoted += c == '\'' ? std::string("'\\''") : std::string(1, c);
+    quoted += "'";
+    
+    std::string command = "ffmpeg -v error -nostdin -i " + quoted + " -f f32le -ac 1 -ar " + std::to_string(rate) + " -";
+    FILE* pipe = popen(command.c_str(), "r");
+    if (!pipe) {
+        error = "cannot run ffmpeg";
+        return false;
+    }
+    
+    clip.sample_rate = rate;
+    clip.samples.clear();
+    float block[16384];
+    size_t n;
+    while ((n = std::fread(block, sizeof(float), std::size(block), pipe)) > 0) {
+        clip.samples.insert(clip.samples.end(), block, block + n);
+    }
+    if (pclose(pipe) != 0 || clip.samples.empty()) {
+        error = "ffmpeg could not decode the file";
+        return false;
+    }
+    return true;
+}
+
+bool load_audio(const std::string& path, uint32_t fallback_rate, AudioClip& clip, std::string& error) {
+    std::string ext = path.size() >= 4 ? path.substr(path.size() - 4) : "";
+    std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+    if (ext == ".wav") return load_wav(path, clip, error);
+    return load_with_ffmpeg(path, fallback_rate, clip, error);
+}
+
+// Offline analysis of one file: the same BeatAnalyzer as live capture, fed
+// as fast as the CPU allows, collecting every beat on the file's timeline.
+class OfflineAnalysis : public HopListener {
+public:
+    static constexpr uint32_t DEFAULT_RATE = 44100;
+    static constexpr uint32_t BLOCK_SIZE = 1024;    // mimics a typical PipeWire quantum
+    
+    struct Beat {
+        double time_s;
+        float bpm;
+        float confidence;
+    };
+    
+    explicit OfflineAnalysis(const DetectorOptions& options)
+        : options_(options)
+    {}
+    
+    void on_hop(const HopResult& hop) override {
+        hops_++;
+        if (hop.is_beat) {
+            beats_.push_back({static_cast<double>(hop.sample_index) / sample_rate_, hop.bpm, hop.confidence});
+            beat_samples_.push_back(hop.sample_index);
+            
+            // How far the beat landed from the nearest beat the phase tracker had predicted
+            if (predicted_ && period_ms_ > 0.0f) {
+                double end = static_cast<double>(hop.sample_index + options_.buffer_size);
+                double beats = (end - static_cast<double>(predicted_)) * 1000.0 / sample_rate_ / period_ms_;
+                phase_error_ms_ += std::abs(beats - std::round(beats)) * period_ms_;
+                predicted_beats_++;
+            }
+        }
+        predicted_ = hop.next_beat_sample;
+        period_ms_ = hop.beat_period_ms;
+    }
+    
+    // Analyses `path` and writes its report to `out`. Returns false on errors.
+    bool run(const std::string& path, std::ostream& out) {
+        AudioClip clip;
+        std::string error;
+        if (!load_audio(path, DEFAULT_RATE, clip, error)) {
+            out << " ✗ " << path << ": " << error << std::endl;
+            return false;
+        }
+        sample_rate_ = clip.sample_rate;
+        
+        BeatAnalyzer analyzer(options_.buffer_size, clip.sample_rate, options_.engine, options_.decimation,
+                              options_.enable_pitch_detection, options_.bar_count, options_.enable_bands,
+                              options_.enable_performance_stats, this);
+        analyzer.set_pitch_rate(options_.pitch_rate_hz);
+        if (!analyzer.initialize()) {
+            out << " ✗ " << path << ": failed to build the analysis pipeline" << std::endl;
+            return false;
+        }
+        
+        auto start = std::chrono::steady_clock::now();
+        const float* data = clip.samples.data();
+        for (size_t pos = 0; pos < clip.samples.size(); pos += BLOCK_SIZE) {
+            uint32_t n = static_cast<uint32_t>(std::min<size_t>(BLOCK_SIZE, clip.samples.size() - pos));
+            analyzer.feed_samples(data + pos, n);
+        }
+        wall_s_ = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        audio_s_ = static_cast<double>(clip.samples.size()) / clip.sample_rate;
+        
+        out << " 󰎆 " << path << std::endl;
+        out << "   Audio: " << std::fixed << std::setprecision(1) << audio_s_ << " s @ " << clip.sample_rate
+            << " Hz | Hop: " << analyzer.buf_size() << " | FFT: " << analyzer.fft_size()
+            << " | Engine: " << engine_name(analyzer.engine());
+        if (analyzer.decimation() > 1) {
+            out << " | Tempo path: ÷" << analyzer.decimation() << " (" << clip.sample_rate / analyzer.decimation() << " Hz)";
+        }
+        out << std::endl;
+        out << "   Analysed " << hops_ << " hops in " << std::setprecision(3) << wall_s_ << " s → "
+            << std::setprecision(0) << hops_per_second() << " hops/s, "
+            << std::setprecision(1) << realtime_factor() << "x real time" << std::endl;
+        out << "   Beats: " << beats_.size();
+        if (analyzer.has_bpm_history()) {
+            out << " | Average BPM: " << std::setprecision(1) << analyzer.get_average_bpm()
+                << " | Median: " << analyzer.history().median()
+                << " | Octave-folded: " << analyzer.history().octave_bpm();
+        }
+        out << std::endl;
+        if (const BandOnsets* bands = analyzer.bands()) {
+            out << "   Band events:";
+            for (uint32_t b = 0; b < BandOnsets::COUNT; ++b) {
+                out << (b ? " |" : "") << " " << BandOnsets::BANDS[b].name << " " << bands->total(b);
+            }
+            out << std::endl;
+        }
+        if (predicted_beats_ > 0) {
+            out << "   Phase prediction: mean |error| " << std::setprecision(1) << phase_error_ms_ / predicted_beats_
+                << " ms over " << predicted_beats_ << " beats" << std::endl;
+        }
+        if (clip.has_flight) report_flight(clip, analyzer, out);
+        for (const Beat& beat : beats_) {
+            out << "     " << std::setw(9) << std::setprecision(3) << beat.time_s << " s  BPM "
+                << std::setprecision(1) << beat.bpm << "  conf " << std::setprecision(2) << beat.confidence << std::endl;
+        }
+        if (options_.enable_performance_stats) {
+            analyzer.print_latency_report(out);
+        }
+        return true;
+    }
+    
+    // A flight dump carries the live decisions: set the replay's beats against them
+    void report_flight(const AudioClip& clip, const BeatAnalyzer& analyzer, std::ostream& out) const {
+        const FlightHeader& flight = clip.flight;
+        std::vector<uint64_t> recorded;
+        for (const FlightHop& hop : clip.flight_hops) {
+            if (hop.flags & FlightHop::FLAG_BEAT) recorded.push_back(hop.sample_index);
+        }
+        size_t matched = 0;
+        for (uint64_t beat : recorded) {
+            auto it = std::lower_bound(beat_samples_.begin(), beat_samples_.end(), beat > flight.hop_size ? beat - flight.hop_size : 0);
+            if (it != beat_samples_.end() && *it <= beat + flight.hop_size) matched++;
+        }
+        
+        out << "   Flight recording (" << (flight.reason == FlightHeader::REASON_ANOMALY ? "anomaly" : "signal")
+            << "): " << clip.flight_hops.size() << " hops, " << recorded.size() << " live beats; replay "
+            << beat_samples_.size() << " beats, " << matched << " within a hop of a live one" << std::endl;
+        if (flight.hop_size != analyzer.buf_size() || flight.decimation != analyzer.decimation()
+            || flight.engine != static_cast<uint32_t>(analyzer.engine())) {
+            out << "   ⚠ Recorded with hop " << flight.hop_size << ", ÷" << flight.decimation << ", engine "
+                << engine_name(static_cast<OnsetEngine>(flight.engine)) << "; pass the same options to replay it exactly" << std::endl;
+        }
+    }
+    
+    uint64_t hops() const { return hops_; }
+    double wall_seconds() const { return wall_s_; }
+    double audio_seconds() const { return audio_s_; }
+    double hops_per_second() const { return wall_s_ > 0.0 ? hops_ / wall_s_ : 0.0; }
+    double realtime_factor() const { return wall_s_ > 0.0 ? audio_s_ / wall_s_ : 0.0; }
+
+private:
+    const DetectorOptions& options_;
+    uint32_t sample_rate_ = DEFAULT_RATE;
+    uint64_t hops_ = 0;
+    double wall_s_ = 0.0;
+    double audio_s_ = 0.0;
+    std::vector<Beat> beats_;
+    std::vector<uint64_t> beat_samples_;
+    
+    // Phase prediction accuracy
+    uint64_t predicted_ = 0;
+    float period_ms_ = 0.0f;
+    double phase_error_ms_ = 0.0;
+    uint64_t predicted_beats_ = 0;
+};
+
+// --input mode: analyse every file, spreading them over --jobs threads.
+// Reports are buffered per file and printed in command-line order.
+int run_offline(const DetectorOptions& options) {
+    const size_t count = options.input_files.size();
+    std::vector<std::string> reports(count);
+    std::vector<std::unique_ptr<OfflineAnalysis>> results(count);
+    std::vector<bool> ok(count, false);
+    std::atomic<size_t> next{0};
+    
+    auto worker = [&]() {
+        for (size_t i = next++; i < count; i = next++) {
+            std::ostringstream out;
+            results[i] = std::make_unique<OfflineAnalysis>(options);
+            ok[i] = results[i]->run(options.input_files[i], out);
+            reports[i] = out.str();
+        }
+    };
+    
+    auto start = std::chrono::steady_clock::now();
+    const unsigned jobs = std::max(1u, std::min<unsigned>(options.jobs, static_cast<unsigned>(count)));
+    std::vector<std::thread> threads;
+    for (unsigned j = 1; j < jobs; ++j) threads.emplace_back(worker);
+    worker();
+    for (auto& t : threads) t.join();
+    double wall_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    
+    uint64_t total_hops = 0;
+    double total_audio_s = 0.0;
+    int failures = 0;
+    for (size_t i = 0; i < count; ++i) {
+        std::cout << reports[i];
+        if (!ok[i]) {
+            failures++;
+            continue;
+        }
+        total_hops += results[i]->hops();
+        total_audio_s += results[i]->audio_seconds();
+    }
+    
+    if (count > 1) {
+        std::cout << "\n  Corpus: " << count - failures << " files, " << std::fixed << std::setprecision(1)
+                  << total_audio_s << " s of audio in " << std::setprecision(3) << wall_s << " s on "
+                  << jobs << " thread(s) → " << std::setprecision(0) << (wall_s > 0 ? total_hops / wall_s : 0)
+                  << " hops/s, " << std::setprecision(1) << (wall_s > 0 ? total_audio_s / wall_s : 0)
+                  << "x real time" << std::endl;
+    }
+    return failures == 0 ? 0 : 1;
+}
+
+// --bench: every pipeline stage driven on its own, hop by hop, over one
+// fixed input, then the whole analyser end to end. Reports ns/hop per
+// stage (and allocations per hop in a -DBD_TRACK_ALLOCS build) so a change
+// can be measured against a baseline build run with the same arguments.
+// The input is a deterministic synthetic mix unless a file is given; the
+// hop size is the usual first argument.
+class PipelineBench : public HopListener {
+public:
+    static constexpr uint32_t RATE = 44100;
+    static constexpr double SYNTHETIC_SECONDS = 20.0;
+    static constexpr uint32_t BLOCK_SIZE = 1024;    // like OfflineAnalysis
+    static constexpr uint32_t BENCH_BARS = 32;
+    
+    explicit PipelineBench(const DetectorOptions& options)
+        : options_(options)
+    {}
+    
+    void on_hop(const HopResult& hop) override {
+        if (hop.is_beat) beats_++;
+    }
+    
+    int run() {
+        if (!load_input()) return 1;
+#ifdef BD_TRACK_ALLOCS
+        alloc_tracking::quiet = true;
+#endif
+        const uint32_t hop = options_.buffer_size;
+        const size_t hops = samples_.size() / hop;
+        std::cout << "󰓅 Benchmark: " << input_name_ << ", " << std::fixed << std::setprecision(1)
+                  << static_cast<double>(samples_.size()) / rate_ << " s @ " << rate_ << " Hz, hop " << hop
+                  << " (" << hops << " hops), engine " << engine_name(options_.engine) << std::endl;
+#ifndef BD_TRACK_ALLOCS
+        std::cout << "   (allocations per hop need a -DBD_TRACK_ALLOCS build)" << std::endl;
+#endif
+
+        if (!run_stages(hop, hops) || !run_pipeline(hop, hops)) return 1;
+        print_results();
+        return 0;
+    }
+
+private:
+    struct Stage {
+        const char* name;
+        LatencyHistogram latency;
+        uint64_t allocations = 0;
+        uint64_t calls = 0;
+    };
+    
+    bool load_input() {
+        if (!options_.bench_file.empty()) {
+            AudioClip clip;
+            std::string error;
+            if (!load_audio(options_.bench_file, RATE, clip, error)) {
+                std::cerr << " " << options_.bench_file << ": " << error << std::endl;
+                return false;
+            }
+            samples_ = std::move(clip.samples);
+            rate_ = clip.sample_rate;
+            input_name_ = options_.bench_file;
+            return true;
+        }
+        
+        // 120 BPM kick, off-beat hats and a quiet chord, from a fixed seed
+        rate_ = RATE;
+        input_name_ = "synthetic";
+        samples_.assign(static_cast<size_t>(SYNTHETIC_SECONDS * rate_), 0.0f);
+        const double pi = 3.14159265358979323846;
+        const size_t beat = rate_ / 2;
+        uint32_t seed = 0x2545f491;
+        for (size_t i = 0; i < samples_.size(); ++i) {
+            double t_beat = static_cast<double>(i % beat) / rate_;
+            double t_hat = static_cast<double>((i + beat / 2) % beat) / rate_;
+            seed = seed * 1664525u + 1013904223u;
+            double noise = static_cast<double>(seed >> 8) / (1u << 24) * 2.0 - 1.0;
+            double t = static_cast<double>(i) / rate_;
+            samples_[i] = static_cast<float>(0.6 * std::sin(2.0 * pi * 55.0 * t_beat) * std::exp(-t_beat * 25.0)
+                                           + 0.15 * noise * std::exp(-t_hat * 120.0)
+                                           + 0.05 * (std::sin(2.0 * pi * 220.0 * t) + std::sin(2.0 * pi * 277.2 * t)));
+        }
+        return true;
+    }
+    
+    // Times `body` for one hop into `stage`, counting allocations inside it
+    template <typename Body>
+    static auto timed(Stage& stage, Body&& body) {
+#ifdef BD_TRACK_ALLOCS
+        uint64_t allocations = alloc_tracking::count();
+        struct Count {
+            Stage& stage;
+            uint64_t before;
+            ~Count() { stage.allocations += alloc_tracking::count() - before; }
+        } count{stage, allocations};
+        [[maybe_unused]] RtScope rt;
+#endif
+        struct Lap {
+            Stage& stage;
+            uint64_t start = clock_ns(CLOCK_MONOTONIC);
+            ~Lap() {
+                stage.latency.record(clock_ns(CLOCK_MONOTONIC) - start);
+                stage.calls++;
+            }
+        } lap{stage};
+        return body();
+    }
+    
+    Stage& add_stage(const char* name) {
+        stages_.push_back(std::make_unique<Stage>());
+        stages_.back()->name = name;
+        return *stages_.back();
+    }
+    
+    bool run_stages(uint32_t hop, size_t hops) {
+        const uint32_t fft = hop * 8;
+        const uint32_t factor = options_.decimation > 1 ? options_.decimation : 4;
+        
+        auto frontend = SpectralFrontEnd::create(fft, hop, options_.engine);
+        auto tempo = TempoTracker::create(hop, rate_);
+        auto onset = OnsetPicker::create(hop, rate_, options_.engine);
+        if (!frontend || !tempo || !onset) {
+            std::cerr << " Failed to build the pipeline stages" << std::endl;
+            return false;
+        }
+        SpectralPitch pitch(fft, rate_);
+        SpectrumBars bars(BENCH_BARS, fft, hop, rate_);
+        BandOnsets bands(fft, hop, rate_);
+        Decimator decimator(factor, hop);
+        const GateKernels& gate = gate_kernels::select(hop);
+        const DownmixKernel& downmix = downmix_kernels::select();
+        
+        // Interleaved stereo copy for the downmix stage
+        std::vector<float> stereo(samples_.size() * 2);
+        for (size_t i = 0; i < samples_.size(); ++i) stereo[2 * i] = stereo[2 * i + 1] = samples_[i];
+        std::vector<float> mono(hop);
+        std::vector<float> accumulator(hop);
+        std::vector<float> decimated(hop / factor);
+        
+        Stage& s_gate = add_stage("gate");
+        Stage& s_accumulate = add_stage("accumulate");
+        Stage& s_downmix = add_stage("downmix (2ch)");
+        Stage& s_decimate = add_stage(factor == 2 ? "decimate ÷2" : factor == 4 ? "decimate ÷4" : "decimate ÷8");
+        Stage& s_spectrum = add_stage("spectrum");
+        Stage& s_tempo = add_stage("tempo");
+        Stage& s_onset = add_stage("onset");
+        Stage& s_pitch = add_stage("pitch");
+        Stage& s_bars = add_stage("bars");
+        Stage& s_bands = add_stage("bands");
+        Stage& s_format = add_stage("format");
+        
+        float sink = 0.0f;                          // keeps results observable
+        for (size_t h = 0; h < hops; ++h) {
+            const float* in = samples_.data() + h * hop;
+            fvec_t hop_view;
+            hop_view.length = hop;
+            hop_view.data = const_cast<float*>(in);
+            
+            GateStats stats = timed(s_gate, [&] { return gate.measure_hop(in, hop); });
+            sink += timed(s_accumulate, [&] { return gate.copy_measure(accumulator.data(), in, hop); }).peak;
+            timed(s_downmix, [&] { downmix.mix(mono.data(), stereo.data() + h * hop * 2, hop, 2); });
+            timed(s_decimate, [&] { decimator.process(in, hop, decimated.data()); });
+            timed(s_spectrum, [&] { frontend->process(&hop_view); });
+            timed(s_tempo, [&] { tempo->process(frontend->tempo_odf()); });
+            sink += timed(s_onset, [&] { return onset->process(frontend->onset_odf(), &hop_view); });
+            sink += timed(s_pitch, [&] { return pitch.estimate(frontend->spectrum()); });
+            timed(s_bars, [&] { bars.process(frontend->spectrum()); });
+            sink += timed(s_bands, [&] { return bands.process(frontend->spectrum()); });
+            timed(s_format, [&] {
+                TextLine line;
+                line << " [DEBUG] Frame #" << h << " | Amp: ";
+                line.fixed(stats.peak, 4) << " | BPM: ";
+                line.fixed(tempo->bpm(), 1) << " | Conf: ";
+                line.fixed(tempo->confidence(), 2) << "\n";
+                return line.size();
+            });
+        }
+        sink_ = sink + mono[0] + decimated[0];
+        return true;
+    }
+    
+    // The real analyser on BLOCK_SIZE blocks, hop accumulation included
+    bool run_pipeline(uint32_t hop, size_t hops) {
+        BeatAnalyzer analyzer(hop, rate_, options_.engine, options_.decimation, options_.enable_pitch_detection,
+                              options_.bar_count, options_.enable_bands, false, this);
+        analyzer.set_pitch_rate(options_.pitch_rate_hz);
+        if (!analyzer.initialize()) return false;
+        
+        Stage& s_pipeline = add_stage("pipeline");
+#ifdef BD_TRACK_ALLOCS
+        uint64_t allocations = alloc_tracking::count();
+#endif
+        uint64_t start = clock_ns(CLOCK_MONOTONIC);
+        {
+            [[maybe_unused]] RtScope rt;
+            for (size_t pos = 0; pos + BLOCK_SIZE <= hops * hop; pos += BLOCK_SIZE) {
+                analyzer.feed_samples(samples_.data() + pos, BLOCK_SIZE);
+            }
+        }
+        pipeline_ns_ = clock_ns(CLOCK_MONOTONIC) - start;
+#ifdef BD_TRACK_ALLOCS
+        s_pipeline.allocations = alloc_tracking::count() - allocations;
+#endif
+        s_pipeline.calls = analyzer.frame_count();
+        return true;
+    }
+    
+    void print_results() const {
+        std::cout << "   " << std::left << std::setw(16) << "stage" << std::right << std::setw(10) << "ns/hop"
+                  << std::setw(10) << "p50" << std::setw(10) << "p99" << std::setw(12) << "allocs/hop" << std::endl;
+        for (const auto& stage : stages_) {
+            const bool pipeline = stage->latency.count() == 0;
+            double per_hop = pipeline ? (stage->calls ? static_cast<double>(pipeline_ns_) / stage->calls : 0.0)
+                                      : stage->latency.mean_ns();
+            std::cout << "   " << std::left << std::setw(16) << stage->name << std::right << std::fixed
+                      << std::setprecision(0) << std::setw(10) << per_hop;
+            if (pipeline) {
+                std::cout << std::setw(10) << "-" << std::setw(10) << "-";
+            } else {
+                std::cout << std::setw(10) << stage->latency.percentile_ns(0.50)
+                          << std::setw(10) << stage->latency.percentile_ns(0.99);
+            }
+#ifdef BD_TRACK_ALLOCS
+            std::cout << std::setw(12) << std::setprecision(2)
+                      << (stage->calls ? static_cast<double>(stage->allocations) / stage->calls : 0.0);
+#else
+            std::cout << std::setw(12) << "-";
+#endif
+            std::cout << std::endl;
+        }
+        double audio_s = static_cast<double>(samples_.size()) / rate_;
+        std::cout << "   Pipeline: " << std::setprecision(1) << audio_s / (pipeline_ns_ / 1e9) << "x real time, "
+                  << beats_ << " beats (per-stage times include ~20-30 ns of clock reads)" << std::endl;
+    }
+    
+    const DetectorOptions& options_;
+    std::vector<float> samples_;
+    uint32_t rate_ = RATE;
+    std::string input_name_;
+    std::vector<std::unique_ptr<Stage>> stages_;
+    uint64_t pipeline_ns_ = 0;
+    uint64_t beats_ = 0;
+    volatile float sink_ = 0.0f;
+};
+
+// "2", "0,2" or "2-5,7", as taskset -c takes them
+bool parse_cpu_list(const std::string& list, std::vector<int>& cpus) {
+    cpus.clear();
+    std::istringstream items(list);
+    std::string item;
+    while (std::getline(items, item, ',')) {
+        try {
+            size_t dash = item.find('-');
+            int first = std::stoi(item.substr(0, dash));
+            int last = dash == std::string::npos ? first : std::stoi(item.substr(dash + 1));
+            if (first < 0 || last < first || last >= CPU_SETSIZE) return false;
+            for (int cpu = first; cpu <= last; ++cpu) cpus.push_back(cpu);
+        } catch (...) {
+            return false;
+        }
+    }
+    return !cpus.empty();
+}
+
 void print_usage() {
     std::cout << " Beat Detector Usage:" << std::endl;
     std::cout << "  ./beat_detector [buffer_size] [options]" << std::endl;
     std::cout << "\nOptions:" << std::endl;
+    std::cout << "  --engine <e>      Onset engine: aubio (HFC, default) or flux (built-in SIMD spectral flux)" << std::endl;
+    std::cout << "  --decimate <n>    Run tempo and onsets at rate/n (1, 2, 4 or 8; bars and pitch stay at full rate)" << std::endl;
     std::cout << "  --no-log          Disable logging to file" << std::endl;
+    std::cout << "  --log-format <f>  Log format: csv (default) or binary (.bdl)" << std::endl;
+    std::cout << "  --convert-log <f> Print a binary .bdl log as CSV and exit" << std::endl;
     std::cout << "  --no-stats        Disable performance statistics" << std::endl;
-    std::cout << "  --pitch           Enable pitch detection" << std::endl;
+    std::cout << "  --stats-interval <s>  Print latency percentiles every s seconds (also on SIGUSR1)" << std::endl;
+    std::cout << "  --idle-after <s>  Request a large quantum after s seconds of silence (default: 10, 0 = off)" << std::endl;
+    std::cout << "  --match-quantum   Request a PipeWire quantum of one hop (rounds the hop to a power of two)" << std::endl;
+    std::cout << "  --quantum-hops <n>  Like --match-quantum, with n hops per callback" << std::endl;
+    std::cout << "  --pitch           Enable pitch detection (on a worker thread)" << std::endl;
+    std::cout << "  --pitch-rate <hz> Pitch estimates per second besides every beat (default: 10, 0 = beats only)" << std::endl;
     std::cout << "  --no-visual       Disable visual feedback" << std::endl;
+    std::cout << "  --no-mlock        Do not lock the process in memory (mlockall) at startup" << std::endl;
+    std::cout << "  --worker          Run analysis on a worker thread (RT callback only copies)" << std::endl;
+    std::cout << "  --target <node>   Capture this node (repeatable): sink (default sink monitor), mic" << std::endl;
+    std::cout << "                    (default source), or a node name/serial such as an app's stream;" << std::endl;
+    std::cout << "                    several targets are analysed separately and tagged by node id" << std::endl;
+    std::cout << "  --pool <n>        Analysis worker threads, with work stealing (default: one per target)" << std::endl;
+    std::cout << "  --rt-priority <n> Run the analysis workers SCHED_FIFO at n (1-99), directly or via rtkit" << std::endl;
+    std::cout << "  --worker-cpus <l> Pin the analysis workers to CPUs l (e.g. 2 or 0,2-3)" << std::endl;
+    std::cout << "  --renderer-cpus <l>  Pin the console renderer to CPUs l" << std::endl;
+    std::cout << "  --degrade <ms>    Shed a stage per ms of analysis backlog: pitch, bars, then tempo" << std::endl;
+    std::cout << "                    (onsets only); 0 = never (default: 100)" << std::endl;
+    std::cout << "  --degrade-limit <level>  Deepest level to shed to: pitch, bars or onset (default: onset)" << std::endl;
+    std::cout << "  --record [s]      Keep the last s seconds of audio and decisions (default: 30); SIGUSR2" << std::endl;
+    std::cout << "                    or an anomaly dumps them to a WAV file that --input replays" << std::endl;
+    std::cout << "  --shm [name]      Publish state to /dev/shm/<name> (default: beat_detector; not purely numeric)" << std::endl;
+    std::cout << "  --shm-rate <hz>   Maximum shared-memory update rate (default: 60)" << std::endl;
+    std::cout << "  --shm-eventfd     Signal every shared-memory update on an eventfd (EVENTFD on --daemon hands it out)" << std::endl;
+    std::cout << "  --daemon [path]   Serve subscribers on a Unix socket (default: $XDG_RUNTIME_DIR/beat_detector.sock);" << std::endl;
+    std::cout << "                    capture runs only while at least one client is subscribed" << std::endl;
+    std::cout << "  --daemon-rate <hz>  Maximum update rate per subscriber, beats always sent (default: 60)" << std::endl;
+    std::cout << "  --bars <n>        Compute n log-spaced spectrum bars (max 256)" << std::endl;
+    std::cout << "  --bands           Detect kick, snare and hi-hat events from the same spectrum" << std::endl;
+    std::cout << "  --bars-stdout     Also print bars as 'BARS: v;v;...;' lines (0-100), dropped if the reader stalls" << std::endl;
+    std::cout << "  --bars-fps <fps>  Maximum rate of bar lines on stdout (default: 30)" << std::endl;
+    std::cout << "  --input <file>    Analyse a file offline, as fast as possible (repeatable;" << std::endl;
+    std::cout << "                    WAV is read natively, other formats are decoded with ffmpeg)" << std::endl;
+    std::cout << "  --jobs <n>        Analyse up to n input files in parallel (default: 1)" << std::endl;
+    std::cout << "  --bench [file]    Time every pipeline stage per hop on a synthetic mix (or file)" << std::endl;
     std::cout << "  --help            Show this help" << std::endl;
+    std::cout << "\nControl (stdin, or the --daemon socket), without restarting capture:" << std::endl;
+    std::cout << "  SET <key>=<value>[,...]  hop, engine, decimate, pitch, pitch-rate, bars, bands rebuild the" << std::endl;
+    std::cout << "                    pipeline and keep the BPM history; gate (dB), onset, tempo," << std::endl;
+    std::cout << "                    confidence and ioi (ms) are applied in place" << std::endl;
+    std::cout << "  CONFIG            Print the current settings" << std::endl;
     std::cout << "\nExamples:" << std::endl;
     std::cout << "  ./beat_detector 128               # Small buffer for low latency" << std::endl;
     std::cout << "  ./beat_detector 256 --pitch       # Medium buffer with pitch detection" << std::endl;
     std::cout << "  ./beat_detector 512 --no-visual   # Large buffer, no visual feedback" << std::endl;
+    std::cout << "  ./beat_detector 256 --worker --rt-priority 20 --worker-cpus 3   # Analysis off the graph, still RT" << std::endl;
+    std::cout << "  ./beat_detector 256 --shm --no-visual --no-log   # Binary output for other processes" << std::endl;
+    std::cout << "  ./beat_detector 128 --input a.wav --input b.flac --jobs 2   # Offline benchmark" << std::endl;
+    std::cout << "  ./beat_detector 128 --engine flux --input a.wav   # Compare with the default aubio engine" << std::endl;
+    std::cout << "  ./beat_detector 512 --decimate 4 --input a.wav    # Check the decimated tempo path against full rate" << std::endl;
+    std::cout << "  ./beat_detector 256 --target sink --target mic --pool 2   # Tempo of playback and microphone" << std::endl;
+    std::cout << "  ./beat_detector 256 --daemon --bars 64 --no-visual   # then: echo 'SUBSCRIBE bpm,beat' | socat - UNIX:$XDG_RUNTIME_DIR/beat_detector.sock" << std::endl;
+    std::cout << "  echo 'SET hop=512,pitch=on' | socat - UNIX:$XDG_RUNTIME_DIR/beat_detector.sock   # Retune a running daemon" << std::endl;
 }
 
 int main(int argc, char* argv[]) {
-    uint32_t buffer_size = 128;
-    bool enable_logging = true;
-    bool enable_performance_stats = true;
-    bool enable_pitch_detection = false;
-    bool enable_visual_feedback = true;
+#ifdef BD_TRACK_ALLOCS
+    alloc_tracking::init();
+#endif
+    DetectorOptions options;
     
     for (int i = 1; i < argc; ++i) {
         std::string arg = argv[i];
@@ -624,18 +6064,223 @@ int main(int argc, char* argv[]) {
         if (arg == "--help" || arg == "-h") {
             print_usage();
             return 0;
+        } else if (arg == "--engine" && i + 1 < argc) {
+            std::string engine = argv[++i];
+            if (engine == "aubio") {
+                options.engine = OnsetEngine::Aubio;
+            } else if (engine == "flux") {
+                options.engine = OnsetEngine::Flux;
+            } else {
+                std::cerr << " Unknown onset engine: " << engine << std::endl;
+                return 1;
+            }
+        } else if (arg == "--decimate" && i + 1 < argc) {
+            try {
+                options.decimation = std::stoul(argv[++i]);
+                if (options.decimation != 1 && options.decimation != 2 && options.decimation != 4 && options.decimation != 8) {
+                    std::cerr << " Decimation must be 1, 2, 4 or 8" << std::endl;
+                    return 1;
+                }
+            } catch (...) {
+                std::cerr << " Invalid decimation: " << argv[i] << std::endl;
+                return 1;
+            }
         } else if (arg == "--no-log") {
-            enable_logging = false;
+            options.enable_logging = false;
+        } else if (arg == "--log-format" && i + 1 < argc) {
+            std::string format = argv[++i];
+            if (format == "csv") {
+                options.log_format = BeatLogger::Format::Csv;
+            } else if (format == "binary") {
+                options.log_format = BeatLogger::Format::Binary;
+            } else {
+                std::cerr << " Unknown log format: " << format << std::endl;
+                return 1;
+            }
+        } else if (arg == "--convert-log" && i + 1 < argc) {
+            if (!BeatLogger::convert_to_csv(argv[++i], std::cout)) {
+                std::cerr << " Not a binary beat log: " << argv[i] << std::endl;
+                return 1;
+            }
+            return 0;
         } else if (arg == "--no-stats") {
-            enable_performance_stats = false;
+            options.enable_performance_stats = false;
+        } else if (arg == "--stats-interval" && i + 1 < argc) {
+            try {
+                options.stats_interval_s = std::stof(argv[++i]);
+            } catch (...) {
+                std::cerr << " Invalid stats interval: " << argv[i] << std::endl;
+                return 1;
+            }
+        } else if (arg == "--idle-after" && i + 1 < argc) {
+            try {
+                options.idle_after_s = std::stof(argv[++i]);
+            } catch (...) {
+                std::cerr << " Invalid idle delay: " << argv[i] << std::endl;
+                return 1;
+            }
+        } else if (arg == "--match-quantum") {
+            options.quantum_hops = std::max(options.quantum_hops, 1u);
+        } else if (arg == "--quantum-hops" && i + 1 < argc) {
+            try {
+                options.quantum_hops = std::stoul(argv[++i]);
+                if (options.quantum_hops < 1 || options.quantum_hops > 64) {
+                    std::cerr << " Quantum hops must be between 1 and 64" << std::endl;
+                    return 1;
+                }
+            } catch (...) {
+                std::cerr << " Invalid quantum hop count: " << argv[i] << std::endl;
+                return 1;
+            }
         } else if (arg == "--pitch") {
-            enable_pitch_detection = true;
+            options.enable_pitch_detection = true;
+        } else if (arg == "--pitch-rate" && i + 1 < argc) {
+            try {
+                options.pitch_rate_hz = std::stof(argv[++i]);
+                if (options.pitch_rate_hz < 0.0f) throw std::out_of_range("negative rate");
+            } catch (...) {
+                std::cerr << " Invalid pitch rate: " << argv[i] << std::endl;
+                return 1;
+            }
         } else if (arg == "--no-visual") {
-            enable_visual_feedback = false;
+            options.enable_visual_feedback = false;
+        } else if (arg == "--no-mlock") {
+            options.lock_memory = false;
+        } else if (arg == "--worker") {
+            options.enable_worker = true;
+        } else if (arg == "--target" && i + 1 < argc) {
+            options.targets.push_back(argv[++i]);
+        } else if (arg == "--pool" && i + 1 < argc) {
+            try {
+                options.pool_threads = std::stoul(argv[++i]);
+                if (options.pool_threads < 1 || options.pool_threads > 64) {
+                    std::cerr << " Pool size must be between 1 and 64" << std::endl;
+                    return 1;
+                }
+            } catch (...) {
+                std::cerr << " Invalid pool size: " << argv[i] << std::endl;
+                return 1;
+            }
+        } else if (arg == "--rt-priority" && i + 1 < argc) {
+            try {
+                options.rt_priority = std::stoi(argv[++i]);
+                if (options.rt_priority < 1 || options.rt_priority > 99) {
+                    std::cerr << " RT priority must be between 1 and 99" << std::endl;
+                    return 1;
+                }
+            } catch (...) {
+                std::cerr << " Invalid RT priority: " << argv[i] << std::endl;
+                return 1;
+            }
+        } else if ((arg == "--worker-cpus" || arg == "--renderer-cpus") && i + 1 < argc) {
+            std::vector<int>& cpus = arg == "--worker-cpus" ? options.worker_cpus : options.renderer_cpus;
+            if (!parse_cpu_list(argv[++i], cpus)) {
+                std::cerr << " Invalid CPU list: " << argv[i] << " (e.g. 2 or 0,2-3)" << std::endl;
+                return 1;
+            }
+        } else if (arg == "--degrade" && i + 1 < argc) {
+            try {
+                options.degrade_step_ms = std::stof(argv[++i]);
+                if (options.degrade_step_ms < 0.0f || options.degrade_step_ms > 10000.0f) {
+                    std::cerr << " Degrade step must be between 0 and 10000 ms" << std::endl;
+                    return 1;
+                }
+            } catch (...) {
+                std::cerr << " Invalid degrade step: " << argv[i] << std::endl;
+                return 1;
+            }
+        } else if (arg == "--degrade-limit" && i + 1 < argc) {
+            std::string level = argv[++i];
+            if (level == "pitch") {
+                options.degrade_limit = Degrade::NoPitch;
+            } else if (level == "bars") {
+                options.degrade_limit = Degrade::NoBars;
+            } else if (level == "onset") {
+                options.degrade_limit = Degrade::OnsetOnly;
+            } else {
+                std::cerr << " Unknown degrade limit: " << level << " (use pitch, bars or onset)" << std::endl;
+                return 1;
+            }
+        } else if (arg == "--record") {
+            options.record_s = 30.0f;
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                try {
+                    options.record_s = std::stof(argv[++i]);
+                    if (options.record_s < 1.0f || options.record_s > 600.0f) {
+                        std::cerr << " Flight recorder length must be between 1 and 600 seconds" << std::endl;
+                        return 1;
+                    }
+                } catch (...) {
+                    std::cerr << " Invalid flight recorder length: " << argv[i] << std::endl;
+                    return 1;
+                }
+            }
+        } else if (arg == "--shm") {
+            // A bare number after --shm is the positional buffer size, not a name
+            bool named = i + 1 < argc && argv[i + 1][0] != '-'
+                         && std::string_view(argv[i + 1]).find_first_not_of("0123456789") != std::string_view::npos;
+            options.shm_name = named ? argv[++i] : "beat_detector";
+        } else if (arg == "--daemon") {
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                options.daemon_socket = argv[++i];
+            } else {
+                const char* runtime_dir = std::getenv("XDG_RUNTIME_DIR");
+                options.daemon_socket = std::string(runtime_dir ? runtime_dir : "/tmp") + "/beat_detector.sock";
+            }
+        } else if (arg == "--daemon-rate" && i + 1 < argc) {
+            try {
+                options.daemon_rate_hz = std::stof(argv[++i]);
+            } catch (...) {
+                std::cerr << " Invalid daemon update rate: " << argv[i] << std::endl;
+                return 1;
+            }
+        } else if (arg == "--shm-rate" && i + 1 < argc) {
+            try {
+                options.shm_rate_hz = std::stof(argv[++i]);
+            } catch (...) {
+                std::cerr << " Invalid shared-memory rate: " << argv[i] << std::endl;
+                return 1;
+            }
+        } else if (arg == "--shm-eventfd") {
+            options.shm_eventfd = true;
+        } else if (arg == "--bars" && i + 1 < argc) {
+            try {
+                options.bar_count = std::stoul(argv[++i]);
+                if (options.bar_count < 1 || options.bar_count > SpectrumBars::MAX_BARS) {
+                    std::cerr << " Bar count must be between 1 and " << SpectrumBars::MAX_BARS << std::endl;
+                    return 1;
+                }
+            } catch (...) {
+                std::cerr << " Invalid bar count: " << argv[i] << std::endl;
+                return 1;
+            }
+        } else if (arg == "--bands") {
+            options.enable_bands = true;
+        } else if (arg == "--bars-stdout") {
+            options.bars_stdout = true;
+        } else if (arg == "--bars-fps" && i + 1 < argc) {
+            try {
+                options.bars_fps = std::stof(argv[++i]);
+            } catch (...) {
+                std::cerr << " Invalid bar rate: " << argv[i] << std::endl;
+                return 1;
+            }
+        } else if (arg == "--bench") {
+            options.bench = true;
+            if (i + 1 < argc && argv[i + 1][0] != '-') options.bench_file = argv[++i];
+        } else if (arg == "--input" && i + 1 < argc) {
+            options.input_files.push_back(argv[++i]);
+        } else if (arg == "--jobs" && i + 1 < argc) {
+            try {
+                options.jobs = std::stoul(argv[++i]);
+            } catch (...) {
+                std::cerr << " Invalid job count: " << argv[i] << std::endl;
+                return 1;
+            }
         } else if (arg[0] != '-') {
             try {
-                buffer_size = std::stoul(arg);
-                if (buffer_size < 64 || buffer_size > 8192) {
+                options.buffer_size = std::stoul(arg);
+                if (options.buffer_size < 64 || options.buffer_size > 8192) {
                     std::cerr << " Buffer size must be between 64 and 8192" << std::endl;
                     return 1;
                 }
@@ -650,13 +6295,32 @@ int main(int argc, char* argv[]) {
         }
     }
     
+    // Power-of-two hops keep the FFT (8x hop) radix-2 and line up with the
+    // quantum sizes PipeWire schedules
+    if (options.quantum_hops > 0 && (options.buffer_size & (options.buffer_size - 1)) != 0) {
+        uint32_t lower = 1u << (31 - __builtin_clz(options.buffer_size));
+        uint32_t rounded = options.buffer_size - lower < 2 * lower - options.buffer_size ? lower : 2 * lower;
+        rounded = std::min(std::max(rounded, 64u), 8192u);
+        std::cout << " Hop rounded from " << options.buffer_size << " to " << rounded << " samples" << std::endl;
+        options.buffer_size = rounded;
+    }
+    if (!BeatAnalyzer::check_decimation(options.buffer_size, options.decimation)) return 1;
+    
+    if (options.bench) {
+        return PipelineBench(options).run();
+    }
+    
+    if (!options.input_files.empty()) {
+        return run_offline(options);
+    }
+    
     std::signal(SIGINT, EnhancedBeatDetector::signal_handler);
     std::signal(SIGTERM, EnhancedBeatDetector::signal_handler);
     
     try {
-        EnhancedBeatDetector detector(buffer_size, enable_logging, enable_performance_stats,
-                                     enable_pitch_detection, enable_visual_feedback);
+        EnhancedBeatDetector detector(options);
         detector.run();
+        if (!detector.ok()) return 1;
     } catch (const std::exception& e) {
         std::cerr << " Error: " << e.what() << std::endl;
         return 1;
@@ -669,4 +6333,8 @@ int main(int argc, char* argv[]) {
  * Compilation command:
  * g++ -std=c++17 -O3 -Wall -Wextra -I/usr/include/pipewire-0.3 -I/usr/include/spa-0.2 -I/usr/include/aubio \
  *     -o beat_detector beat_detector.cpp -lpipewire-0.3 -laubio -pthread
+ *
+ * Benchmarking: build once from the baseline and once from the change, then compare
+ *     ./beat_detector 512 --bench [file.wav]
+ * Add -DBD_TRACK_ALLOCS to fill in the allocs/hop column.
  */
@@ -57,6 +57,10 @@ Item {
         service: Cava
     }
 
+    Ref {
+        service: BeatDetector
+    }
+
     Shape {
         id: visualiser
 
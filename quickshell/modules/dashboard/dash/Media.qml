@@ -33,6 +33,10 @@ Item {
         onTriggered: Players.active?.positionChanged()
     }
 
+    Ref {
+        service: BeatDetector
+    }
+
     Shape {
         preferredRendererType: Shape.CurveRenderer
 
@@ -0,0 +1,22 @@
+pragma Singleton
+
+import qs.config
+import Quickshell
+import Quickshell.Io
+import QtQuick
+
+Singleton {
+    id: root
+
+    // One beat_detector serves every consumer (and any other tool) over this socket
+    readonly property string socketPath: `${Quickshell.env("XDG_RUNTIME_DIR") || "/tmp"}/beat_detector.sock`
+    readonly property bool needed: BeatDetector.refCount > 0 || Cava.refCount > 0
+
+    Process {
+        id: daemonProc
+
+        // Exits straight away if another detector already owns the socket, which is fine
+        running: root.needed
+        command: [Quickshell.env("CAELESTIA_BD_PATH") || "/home/nafi/.config/quickshell/caelestia/assets/beat_detector", "256", "--daemon", root.socketPath, "--bars", `${Config.dashboard.visualiserBars}`, "--bands", "--no-log", "--no-stats", "--no-visual"]
+    }
+}
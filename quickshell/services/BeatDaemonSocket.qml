@@ -0,0 +1,25 @@
+import Quickshell.Io
+import QtQuick
+
+// A connection to the shared beat_detector daemon, held open while `active`
+Socket {
+    id: root
+
+    property bool active
+
+    readonly property Timer reconnect: Timer {
+        // The daemon may still be starting, or may have been restarted
+        running: root.active && !root.connected
+        interval: 500
+        repeat: true
+        triggeredOnStart: true
+        onTriggered: root.connected = true
+    }
+
+    path: BeatDaemon.socketPath
+
+    onActiveChanged: {
+        if (!active)
+            connected = false;
+    }
+}
@@ -2,22 +2,61 @@ pragma Singleton
 
 import Quickshell
 import Quickshell.Io
+import QtQuick
 
 Singleton {
     id: root
 
     property real bpm: 1
+    // 0..1 through the current beat, from the detector's phase tracker
+    property real phase
+    property int refCount
 
-    Process {
-        id: beatDetectorProc
-        running: false  // Only run when explicitly needed
-        command: [Quickshell.env("CAELESTIA_BD_PATH") || "/home/nafi/.config/quickshell/caelestia/assets/beat_detector", "190", "--no-log", "--no-stats", "--no-visual"]
-        stdout: SplitParser {
+    // Fires at the predicted time of each beat, ahead of the detector reporting it
+    signal beat
+    // Band-resolved hits as the detector reports them, one hop after the onset
+    signal kick
+    signal snare
+    signal hat
+
+    BeatDaemonSocket {
+        id: socket
+
+        active: root.refCount > 0
+        onConnectedChanged: {
+            if (connected) {
+                write("SUBSCRIBE bpm,phase,next,bands\n");
+                flush();
+            }
+        }
+        parser: SplitParser {
             onRead: data => {
-                const match = data.match(/\s*BPM: ([0-9]+\.[0-9]+)/);
+                const match = data.match(/\bbpm=([0-9]+\.[0-9]+)/);
                 if (match)
                     root.bpm = parseFloat(match[1]);
+                const phase = data.match(/\bphase=([0-9.]+)/);
+                if (phase)
+                    root.phase = parseFloat(phase[1]);
+                const next = data.match(/\bnext_in=([0-9]+\.[0-9]+)/);
+                if (next) {
+                    beatTimer.interval = Math.round(parseFloat(next[1]));
+                    beatTimer.restart();
+                } else if (data.includes("next_in=-1")) {
+                    beatTimer.stop();
+                }
+                if (/\bkick=[1-9]/.test(data))
+                    root.kick();
+                if (/\bsnare=[1-9]/.test(data))
+                    root.snare();
+                if (/\bhat=[1-9]/.test(data))
+                    root.hat();
             }
         }
     }
+
+    Timer {
+        id: beatTimer
+
+        onTriggered: root.beat()
+    }
 }
@@ -11,25 +11,39 @@ Singleton {
     property list<int> values: Array(Config.dashboard.visualiserBars)
     property int refCount
 
+    function subscribe(): void {
+        // The daemon keeps running across bar count changes; it rebuilds its
+        // bars in place, and only when the count actually differs
+        socket.write(`SET bars=${Config.dashboard.visualiserBars}\n`);
+        socket.write(`SUBSCRIBE bars=${Config.dashboard.visualiserBars}\n`);
+        socket.flush();
+    }
+
     Connections {
         target: Config.dashboard
 
         function onVisualiserBarsChanged() {
             root.values = Array(Config.dashboard.visualiserBars);
-            cavaProc.running = false;
-            cavaProc.running = true;
+            if (socket.connected)
+                root.subscribe();
         }
     }
 
-    Process {
-        id: cavaProc
+    // Bars come from the shared beat_detector daemon's spectrum instead of a second capture + FFT in cava
+    BeatDaemonSocket {
+        id: socket
 
-        running: root.refCount > 0  // Only run when actually needed
-        command: ["sh", "-c", `printf '[general]\nframerate=30\nbars=${Config.dashboard.visualiserBars}\nsleep_timer=3\n[output]\nchannels=mono\nmethod=raw\nraw_target=/dev/stdout\ndata_format=ascii\nascii_max_range=100' | cava -p /dev/stdin`]  // Reduced framerate from 60 to 30
-        stdout: SplitParser {
+        active: root.refCount > 0
+        onConnectedChanged: {
+            if (connected)
+                root.subscribe();
+        }
+        parser: SplitParser {
             onRead: data => {
-                if (root.refCount)
-                    root.values = data.slice(0, -1).split(";").map(v => parseInt(v, 10));
+                const start = data.indexOf(" bars=");
+                // Only updates; the OK replies to SET and SUBSCRIBE echo bars= too
+                if (root.refCount && start >= 0 && data.startsWith("U "))
+                    root.values = data.slice(start + 6, -1).split(";").map(v => parseInt(v, 10));
             }
         }
     }